@@ -0,0 +1,176 @@
+// Runs the benchmark programs on each engine and prints one JSON object
+// per program and engine:
+//
+//   {"workload":"fibs","engine":"machine","runs":3,"seconds":0.48,
+//    "reductions":...,"reductions_per_second":...,"peak_rss_kb":...,
+//    "allocations":...,"status":0}
+//
+//   bench/bench [--runs=N] [--engine=NAME]... [--interpreter=PATH]
+//
+// To be run from the top of the repository, where ULC finds its prelude.
+// `seconds` is the best wall time of the runs, `peak_rss_kb` the largest
+// resident set. Reductions and allocations are reported by ULC itself
+// with --eval-stats and --heap-stats. Deep recursion needs a large C++
+// stack on the recursive engine, the stack limit is lifted for the runs.
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+namespace{
+
+struct Workload{
+  const char * name;
+  const char * program;
+  // Lines fed to the standard input, none if 0
+  int inputLines;
+  // Run on the net engine too. The net has no IO, and the brackets and
+  // croissants of the other programs grow until they run out of memory
+  // or take minutes, so those are skipped there.
+  bool net;
+};
+
+const Workload workloads[] = {
+  {"church", "bench/programs/church.ulc", 0, true},
+  {"fibs", "bench/programs/fibs.ulc", 0, false},
+  {"sort", "bench/programs/sort.ulc", 0, false},
+  {"strings", "bench/programs/strings.ulc", 0, false},
+  {"recursion", "bench/programs/recursion.ulc", 0, false},
+  {"echo", "bench/programs/echo.ulc", 20000, false},
+};
+
+struct Result{
+  double seconds;
+  long peakKilobytes;
+  unsigned long long reductions;
+  unsigned long long allocations;
+  int status;
+};
+
+// A file holding the input of a workload, unlinked already
+int inputFile(int lines){
+  char path[] = "/tmp/ulc-bench-XXXXXX";
+  int fd = mkstemp(path);
+  if(fd < 0){
+    cerr << "[Bench] Cannot create the input file" << endl;
+    exit(1);
+  }
+  unlink(path);
+  string text;
+  for(int i = 1; i <= lines; ++i)
+    text += "line " + to_string(i) + " of the echo benchmark\n";
+  if(write(fd, text.data(), text.size()) != (ssize_t)text.size()){
+    cerr << "[Bench] Cannot write the input file" << endl;
+    exit(1);
+  }
+  return fd;
+}
+
+unsigned long long statistic(const string& report, const char * label){
+  size_t at = report.find(label);
+  return at == string::npos ? 0 : strtoull(report.c_str() + at + strlen(label), nullptr, 10);
+}
+
+Result run(const string& interpreter, const string& engine, const Workload& workload){
+  int input = workload.inputLines ? inputFile(workload.inputLines) : open("/dev/null", O_RDONLY);
+  int report[2];
+  if(pipe(report) < 0){
+    cerr << "[Bench] Cannot create a pipe" << endl;
+    exit(1);
+  }
+  auto start = chrono::steady_clock::now();
+  pid_t child = fork();
+  if(child == 0){
+    struct rlimit stack = {RLIM_INFINITY, RLIM_INFINITY};
+    setrlimit(RLIMIT_STACK, &stack);
+    lseek(input, 0, SEEK_SET);
+    dup2(input, STDIN_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(report[1], STDERR_FILENO);
+    close(report[0]);
+    string engineFlag = "--engine=" + engine;
+    execl(interpreter.c_str(), interpreter.c_str(), engineFlag.c_str(), "--eval-stats", "--heap-stats",
+          "--print", workload.program, (char *)nullptr);
+    _exit(127);
+  }
+  close(report[1]);
+  close(input);
+  string text;
+  char block[4096];
+  ssize_t n;
+  while((n = read(report[0], block, sizeof(block))) > 0)
+    text.append(block, n);
+  close(report[0]);
+  int status;
+  struct rusage usage;
+  wait4(child, &status, 0, &usage);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  Result result;
+  result.seconds = elapsed.count();
+  result.peakKilobytes = usage.ru_maxrss;
+  result.reductions = statistic(text, "[Eval] reductions: ");
+  result.allocations = statistic(text, "[Heap] allocations: ");
+  result.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  if(result.status != 0)
+    cerr << "[Bench] " << workload.name << " on " << engine << " failed with status " << result.status << endl;
+  return result;
+}
+
+}
+
+int main(int argc, char *argv[]){
+  int runs = 3;
+  string interpreter = "./ULC";
+  vector<string> engines;
+  for(int i = 1; i < argc; ++i){
+    string arg(argv[i]);
+    if(arg.compare(0, 7, "--runs=") == 0){
+      runs = max(1, atoi(arg.c_str() + 7));
+    }else if(arg.compare(0, 9, "--engine=") == 0){
+      engines.push_back(arg.substr(9));
+    }else if(arg.compare(0, 14, "--interpreter=") == 0){
+      interpreter = arg.substr(14);
+    }else{
+      cerr << "[Bench] Unknown option: " << arg << endl;
+      exit(1);
+    }
+  }
+  if(engines.empty())
+    engines = {"recursive", "machine", "bytecode", "graph"};
+
+  for(const Workload& workload : workloads){
+    for(const string& engine : engines){
+      if(engine == "net" && !workload.net)
+        continue;
+      Result best = run(interpreter, engine, workload);
+      for(int i = 1; i < runs && best.status == 0; ++i){
+        Result next = run(interpreter, engine, workload);
+        best.seconds = min(best.seconds, next.seconds);
+        best.peakKilobytes = max(best.peakKilobytes, next.peakKilobytes);
+        best.status = next.status;
+      }
+      printf("{\"workload\":\"%s\",\"engine\":\"%s\",\"runs\":%d,\"seconds\":%.6f,"
+             "\"reductions\":%llu,\"reductions_per_second\":%.0f,\"peak_rss_kb\":%ld,"
+             "\"allocations\":%llu,\"status\":%d}\n",
+             workload.name, engine.c_str(), runs, best.seconds,
+             best.reductions, best.reductions / best.seconds, best.peakKilobytes,
+             best.allocations, best.status);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
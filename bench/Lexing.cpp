@@ -0,0 +1,136 @@
+// Lexing throughput of the token grammar, built from the template
+// combinators once and from type-erased parsers rebuilt for every token as
+// the scanner used to, and of the scanner itself.
+//
+//   bench/lexing [FILE]
+//
+// The input, the prelude by default, is repeated up to 4 MB.
+
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <cctype>
+
+#include "../src/Parsers.hpp"
+#include "../src/ExpressionParser.hpp"
+
+using namespace std;
+using namespace Parsers;
+
+namespace{
+
+struct IsAlpha{ bool operator () (char c) const { return isgraph(c) && c != '\\' && c != '(' && c != ')';}};
+struct IsPrint{ bool operator () (char c) const { return isprint(c);}};
+
+class Found{
+    Token& token;
+    Token::Type type;
+  public:
+    Found(Token& t, Token::Type u) : token(t), type(u) {}
+    void operator () (Iterator first, Iterator last) const { token = Token(type, first, last);}
+};
+
+// Tokens read and the sum of their lengths, to check both grammars agree
+struct Count{
+  size_t tokens;
+  size_t length;
+};
+
+Count typed(Iterator first, Iterator last){
+  const auto blanks = *(space | (word("--") >> *noneOf("\n")));
+  Count count{0, 0};
+  Token token;
+  while(true){
+    blanks(first, last);
+    if(first == last) return count;
+    const auto tokenParser = (maybe(oneOf("+-")) >> +digit)[Found(token, Token::Constant)]
+      | (charp('\'') >> satisfy(IsPrint()) >> charp('\''))[Found(token, Token::Constant)]
+      | (+satisfy(IsAlpha()))[Found(token, Token::Identifier)]
+      | charp('\\')[Found(token, Token::Lambda)]
+      | charp('(')[Found(token, Token::LeftBracket)]
+      | charp(')')[Found(token, Token::RightBracket)]
+      | anyChar[Found(token, Token::Undefined)];
+    tokenParser(first, last);
+    ++count.tokens;
+    count.length += token.length;
+  }
+}
+
+// The combinators of the type-erased version, each one wrapping its result
+// in a std::function
+Parser sequence(const Parser& f, const Parser& g){ return f >> g;}
+Parser choice(const Parser& f, const Parser& g){ return f | g;}
+Parser someOf(const Parser& p){ return +p;}
+Parser manyOf(const Parser& p){ return *p;}
+Parser action(const Parser& p, Found f){ return p[f];}
+
+// The grammar is built anew for each token
+Count erased(Iterator first, Iterator last){
+  const Parser blanks = manyOf(choice(space, sequence(word("--"), manyOf(noneOf("\n")))));
+  Count count{0, 0};
+  Token token;
+  while(true){
+    blanks(first, last);
+    if(first == last) return count;
+    const Parser integer = sequence(choice(oneOf("+-"), nothing), someOf(digit));
+    const Parser charLiteral = sequence(sequence(charp('\''), satisfy(IsPrint())), charp('\''));
+    const Parser identifier = someOf(satisfy(IsAlpha()));
+    Parser tokenParser = action(integer, Found(token, Token::Constant));
+    tokenParser = choice(tokenParser, action(charLiteral, Found(token, Token::Constant)));
+    tokenParser = choice(tokenParser, action(identifier, Found(token, Token::Identifier)));
+    tokenParser = choice(tokenParser, action(charp('\\'), Found(token, Token::Lambda)));
+    tokenParser = choice(tokenParser, action(charp('('), Found(token, Token::LeftBracket)));
+    tokenParser = choice(tokenParser, action(charp(')'), Found(token, Token::RightBracket)));
+    tokenParser = choice(tokenParser, action(anyChar, Found(token, Token::Undefined)));
+    tokenParser(first, last);
+    ++count.tokens;
+    count.length += token.length;
+  }
+}
+
+Count scanner(Iterator first, Iterator last){
+  Scanner scanner(string(first, last));
+  Count count{0, 0};
+  while(true){
+    Token token = scanner.getToken();
+    if(token.type == Token::EndOfFile) return count;
+    ++count.tokens;
+    count.length += token.length;
+  }
+}
+
+void measure(const char * name, Count (*lex)(Iterator, Iterator), const string& input){
+  double best = 1e9;
+  Count count{0, 0};
+  for(int i = 0; i < 3; ++i){
+    auto start = chrono::steady_clock::now();
+    count = lex(input.data(), input.data() + input.size());
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    best = min(best, elapsed.count());
+  }
+  cout << name << "\t" << input.size() / best / (1 << 20) << " MB/s\t"
+       << count.tokens << " tokens\t" << count.length << " bytes" << endl;
+}
+
+}
+
+int main(int argc, char *argv[]){
+  const char * path = argc > 1 ? argv[1] : "samplecode/prelude";
+  ifstream file(path, ios::binary);
+  if(!file){
+    cerr << "[Bench] Cannot read " << path << endl;
+    exit(1);
+  }
+  string text(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
+  text += "\n";
+  string input;
+  while(input.size() < (4u << 20))
+    input += text;
+
+  measure("template", typed, input);
+  measure("erased", erased, input);
+  measure("scanner", scanner, input);
+  return 0;
+}
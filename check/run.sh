@@ -0,0 +1,113 @@
+#!/bin/bash
+# Runs every program of check/ on every engine at every optimization
+# level, compiled to C with --compile, and through a server started with
+# --serve. What the program writes to the standard output with --print
+# must be NAME.out, or NAME.O2.out at -O2 if there is one, and it must
+# exit with status 0. NAME.in is its standard input. When NAME.dump
+# exists, the program as optimized by -O1 must end with its content.
+#
+# Lines of a program starting with `-- check:` say more:
+#   -- check: net              it is pure, run it on the net engine too
+#   -- check: args ARGS        run it with ARGS, not compiled then
+#   -- check: status N         it must exit with status N
+#   -- check: stack ENGINES    run it with an 8 MB stack on ENGINES too,
+#                              which keep stacks of their own
+#   -- check: threads ENGINES  run it with --threads=2 on ENGINES too
+#   -- check: heap N ENGINES   on ENGINES, its heap must peak at N bytes
+#                              at most
+#
+#   check/run.sh [ULC]
+
+cd "$(dirname "$0")/.."
+ulc=${1:-./ULC}
+work=$(mktemp -d)
+server=
+trap 'test -n "$server" && kill $server; rm -rf "$work"' EXIT
+# Deep recursion on the recursive engine
+ulimit -s unlimited 2>/dev/null
+
+runs=0
+failures=0
+
+# check LABEL EXPECTED STATUS COMMAND... runs COMMAND on the input
+check(){
+  local label=$1 expected=$2 status=$3
+  shift 3
+  runs=$((runs + 1))
+  "$@" < "$input" > "$work/out" 2> "$work/err"
+  local got=$?
+  if [ $got != "$status" ] || ! cmp -s "$work/out" "$expected"; then
+    failures=$((failures + 1))
+    echo "FAIL $label: status $got"
+    diff "$expected" "$work/out" | head -5
+    head -3 "$work/err"
+  fi
+}
+
+"$ulc" --serve="$work/socket" &
+server=$!
+while [ ! -S "$work/socket" ]; do sleep 0.1; done
+
+for program in check/*.ulc; do
+  name=${program%.ulc}
+  input=$name.in
+  [ -f "$input" ] || input=/dev/null
+  engines="recursive machine bytecode graph"
+  grep -q '^-- check: net' "$program" && engines="$engines net"
+  args=$(sed -n 's/^-- check: args //p' "$program")
+  status=$(sed -n 's/^-- check: status //p' "$program")
+  status=${status:-0}
+  stack=$(sed -n 's/^-- check: stack //p' "$program")
+  heap=$(sed -n 's/^-- check: heap //p' "$program")
+  threads=$(sed -n 's/^-- check: threads //p' "$program")
+
+  for level in 0 1 2; do
+    expected=$name.out
+    [ $level = 2 ] && [ -f "$name.O2.out" ] && expected=$name.O2.out
+    for engine in $engines; do
+      check "$name --engine=$engine -O$level" "$expected" $status \
+        "$ulc" --engine=$engine -O$level --print $args "$program"
+    done
+    for engine in $stack; do
+      check "$name --engine=$engine -O$level, 8 MB stack" "$expected" $status \
+        bash -c 'ulimit -s 8192 && exec "$@"' - \
+        "$ulc" --engine=$engine -O$level --print $args "$program"
+    done
+    for engine in $threads; do
+      check "$name --engine=$engine -O$level --threads=2" "$expected" $status \
+        "$ulc" --engine=$engine -O$level --threads=2 --print $args "$program"
+    done
+    check "$name --connect -O$level" "$expected" $status \
+      "$ulc" --connect="$work/socket" -O$level --print $args "$program"
+    for engine in ${heap#* }; do
+      runs=$((runs + 1))
+      peak=$("$ulc" --engine=$engine -O$level --heap-stats $args "$program" < "$input" 2>&1 >/dev/null \
+        | sed -n 's/.* peak: \([0-9]*\).*/\1/p')
+      if [ -z "$peak" ] || [ "$peak" -gt "${heap%% *}" ]; then
+        failures=$((failures + 1))
+        echo "FAIL $name --engine=$engine -O$level: heap peak ${peak:-unknown} over ${heap%% *}"
+      fi
+    done
+  done
+
+  if [ -z "$args" ]; then
+    if "$ulc" -O1 --compile="$work/program" "$program"; then
+      check "$name --compile" "$name.out" $status "$work/program" --print
+    else
+      failures=$((failures + 1))
+      echo "FAIL $name --compile: not built"
+    fi
+  fi
+
+  if [ -f "$name.dump" ]; then
+    runs=$((runs + 1))
+    dump=$("$ulc" -O1 --dump-optimized "$program")
+    if [[ "$dump" != *"$(cat "$name.dump")" ]]; then
+      failures=$((failures + 1))
+      echo "FAIL $name --dump-optimized: ...${dump: -80}"
+    fi
+  fi
+done
+
+echo "$((runs - failures)) of $runs checks passed"
+[ $failures = 0 ]
@@ -0,0 +1,433 @@
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "Bytecode.hpp"
+#include "Stats.hpp"
+#include "Governor.hpp"
+
+using namespace std;
+
+// Direct threading needs labels as values
+#if defined(__GNUC__)
+#define THREADED
+#endif
+
+namespace{
+
+struct Instruction{
+  enum Op : uint8_t {PushConst, PushThunk, Enter, Free, Const, Closure, Call} op;
+  // Handler of `op` in the interpreter loop
+  const void * handler;
+  int operand;
+  // Arguments bound by a `Call`
+  int count;
+};
+
+const char * const opNames[] = {"PUSH_CONST", "PUSH_THUNK", "ENTER", "FREE", "CONST", "CLOSURE", "CALL"};
+
+// Code of one application spine.
+// The block is found through the tag of the outermost argument, `body`
+// and `arg` tell whether that tag still belongs to this application.
+struct Block{
+  Expression::Ref body;
+  Expression::Ref arg;
+  vector<Instruction> code;
+};
+
+// Block 0 is no block
+vector<Block> blocks(1);
+// Blocks of freed expressions, to be reused
+vector<uint32_t> freeBlocks;
+const void * const * handlers = nullptr;
+
+void link(const void * const * table){
+  handlers = table;
+  for(Block& block : blocks)
+    for(Instruction& ins : block.code)
+      ins.handler = handlers[ins.op];
+}
+
+void emit(Block& block, Instruction::Op op, int operand, int count = 0){
+  block.code.push_back(Instruction{op, handlers ? handlers[op] : nullptr, operand, count});
+}
+
+uint32_t compile(const Expression& ap){
+  Block block{ap.body, ap.arg, vector<Instruction>()};
+  const Expression * e = &ap;
+  Expression::Ref head;
+  int pushed = 0;
+  do{
+    ++pushed;
+    const Expression& arg = Expression::at(e->arg);
+    if(arg.isNum())
+      emit(block, Instruction::PushConst, arg.val);
+    else
+      emit(block, Instruction::PushThunk, e->arg);
+    head = e->body;
+    e = &Expression::at(head);
+  }while(e->isAp());
+
+  switch(e->type){
+    case Expression::Var:
+      if(e->index >= 0)
+        emit(block, Instruction::Enter, e->index);
+      else
+        emit(block, Instruction::Free, head);
+      break;
+    case Expression::Constant:
+      emit(block, Instruction::Const, e->val);
+      break;
+    case Expression::Lambda:
+      {
+        // The lambdas on top that take their argument unevaluated are bound
+        // at once, the others as their argument comes
+        int count = 0;
+        for(const Expression * l = e; count < pushed && l->isLam() && l->strict <= 0; l = &Expression::at(l->body))
+          ++count;
+        if(count > 0)
+          emit(block, Instruction::Call, head, count);
+        else
+          emit(block, Instruction::Closure, head);
+      }
+      break;
+    case Expression::Ap:
+    case Expression::Nothing:
+      cerr << "[Bytecode] Unexpected expression type: " << (int)e->type << endl;
+      exit(1);
+  }
+  uint32_t i = blocks.size();
+  if(freeBlocks.empty()){
+    blocks.push_back(std::move(block));
+  }else{
+    i = freeBlocks.back();
+    freeBlocks.pop_back();
+    blocks[i] = std::move(block);
+  }
+  return Expression::tag(ap.arg) = i;
+}
+
+uint32_t blockOf(const Expression& ap){
+  uint32_t i = Expression::tag(ap.arg);
+  if(i == 0 || blocks[i].body != ap.body || blocks[i].arg != ap.arg)
+    i = compile(ap);
+  return i;
+}
+
+struct Continuation{
+  enum Kind{
+    // The value is the result of the evaluation
+    Done,
+    // Write the weak head normal form back into the top frame of `slot`
+    Update,
+    // The value is the normal form of the body of the lambda `obj`
+    Abstract,
+    // The value is the normal form of the argument of the stuck `obj`
+    Neutral,
+    // The value is the argument of the lambda `obj`, evaluated as its body
+    // needs it anyway
+    Bind
+  } kind;
+  // The value has to be in normal form
+  bool strong;
+  // Arguments below `base` belong to the outer continuations
+  size_t base;
+  Object obj;
+  Context slot;
+
+  Continuation(Kind k, bool s, size_t b, const Object& o) : kind(k), strong(s), base(b), obj(o) {}
+  Continuation(size_t b, const Context& c) : kind(Update), strong(false), base(b), obj(Expression()), slot(c) {}
+};
+
+}
+
+Object Bytecode::evaluate(const Expression& expr, const Context& env, bool strong){
+  // Re-entered by the natives
+  Governor::deep();
+#ifdef THREADED
+  static const void * const table[] = {&&PushConst, &&PushThunk, &&Enter, &&Free, &&Const, &&Closure, &&Call};
+  if(!handlers) link(table);
+#define DISPATCH() goto *pc->handler
+#else
+#define DISPATCH() goto dispatch
+#endif
+
+  vector<Object> args;
+  vector<Continuation> stack;
+  // Primitives re-enter with short evaluations, skip the first regrowths
+  args.reserve(8);
+  stack.reserve(8);
+  stack.emplace_back(Continuation::Done, strong, 0, Object(Expression()));
+  // `control` keeps the running block's expression alive
+  Object control(expr, env);
+  Object value((Expression()));
+  Context frame;
+  const Instruction * pc = nullptr;
+  int index = 0;
+
+enter:
+  if( control.isPrimitive() ){
+    value = control;
+    goto deliver;
+  }
+  {
+    const Expression& e = control.expr();
+    switch( e.type ){
+      case Expression::Constant:
+        value = makeNormalForm( e );
+        goto deliver;
+      case Expression::Var:
+        if( e.index < 0 ){
+          value = makeNormalForm( e );
+          goto deliver;
+        }
+        frame = control.env();
+        index = e.index;
+        goto force;
+      case Expression::Lambda:
+        value = control;
+        goto deliver;
+      case Expression::Ap:
+        frame = control.env();
+        pc = blocks[blockOf(e)].code.data();
+        DISPATCH();
+      case Expression::Nothing:
+        break;
+    }
+    cerr << "[Bytecode] Unexpected expression type: " << (int)e.type << endl;
+    exit(1);
+  }
+
+#ifndef THREADED
+dispatch:
+  switch( pc->op ){
+    case Instruction::PushConst: goto PushConst;
+    case Instruction::PushThunk: goto PushThunk;
+    case Instruction::Enter: goto Enter;
+    case Instruction::Free: goto Free;
+    case Instruction::Const: goto Const;
+    case Instruction::Closure: goto Closure;
+    case Instruction::Call: goto Call;
+  }
+#endif
+
+PushConst:
+  args.push_back(makeNormalForm(Expression(pc->operand)));
+  ++pc;
+  DISPATCH();
+PushThunk:
+  args.push_back(Object(Expression::at(pc->operand), frame));
+  ++pc;
+  DISPATCH();
+Enter:
+  index = pc->operand;
+  goto force;
+Free:
+  value = makeNormalForm(Expression::at(pc->operand));
+  goto deliver;
+Const:
+  value = makeNormalForm(Expression(pc->operand));
+  goto deliver;
+Closure:
+  value = Object(Expression::at(pc->operand), frame);
+  goto deliver;
+Call:
+  {
+    // The arguments were pushed by this block, the first one on top
+    const Expression * lam = &Expression::at(pc->operand);
+    for(int i = 0; i < pc->count; ++i){
+      Governor::step();
+      STATS(Stats::beta(lam));
+      frame = frame.insert(args.back());
+      args.pop_back();
+      lam = &Expression::at(lam->body);
+    }
+    control = Object(*lam, frame);
+    goto enter;
+  }
+
+  // Variable `index` of `frame` is needed
+force:
+  {
+    STATS(++Stats::lookups);
+    Object& slot = frame[index];
+    if( slot.isNormalForm() || slot.isPrimitive() ){
+      value = slot;
+      goto deliver;
+    }
+    control = enterThunk(slot);
+    if( control.isNormalForm() || control.isPrimitive() ){
+      value = control;
+      goto deliver;
+    }
+    // The continuations below normalise the value once it is updated
+    stack.emplace_back(args.size(), frame.drop(index));
+    goto enter;
+  }
+
+  // `value` is in weak head normal form
+deliver:
+  if( args.size() > stack.back().base ){
+    if( value.type() == Object::Closure && value.expr().isLam() ){
+      int strict = value.demands();
+      const Object& arg = args.back();
+      if( strict && args.size() - stack.back().base >= (size_t)strict
+          && arg.type() == Object::Closure && !arg.expr().isLam() ){
+        control = arg;
+        args.pop_back();
+        stack.emplace_back(Continuation::Bind, false, args.size(), value);
+        goto enter;
+      }
+      Governor::step();
+      STATS(Stats::beta(&value.expr()));
+      frame = value.env().insert(args.back());
+      args.pop_back();
+      control = Object(Expression::at(value.expr().body), frame);
+      goto enter;
+    }
+    int missing = value.missing();
+    if( missing > 1 && args.size() - stack.back().base >= (size_t)missing ){
+      // The primitive has all of its arguments on the stack, the last one
+      // deepest as it expects them
+      Object res = value.saturate(&args[args.size() - missing]);
+      args.erase(args.end() - missing, args.end());
+      if( res.isNormalForm() || res.isPrimitive() ){
+        value = res;
+        goto deliver;
+      }
+      control = res;
+      goto enter;
+    }
+    if( value.callable() ){
+      Object arg(args.back());
+      args.pop_back();
+      Object res = value.call(arg.expr(), arg.env());
+      if( res.isNormalForm() || res.isPrimitive() ){
+        value = res;
+        goto deliver;
+      }
+      control = res;
+      goto enter;
+    }
+    control = args.back();
+    args.pop_back();
+    stack.emplace_back(Continuation::Neutral, true, args.size(), value);
+    goto enter;
+  }
+  if( stack.back().strong && value.isPrimitive() ){
+    // Read back as its name applied to the arguments it has collected, the
+    // first one on top
+    for(int i = 0; i < value.applied(); ++i)
+      args.push_back(value.env()[i]);
+    value = makeNormalForm(value.expr());
+    goto deliver;
+  }
+  if( stack.back().strong && value.type() == Object::Closure && value.expr().isLam() ){
+    // The bound variable stays a free, named variable in the normal form
+    Expression var(Expression::Var);
+    var.name = value.expr().name;
+    frame = value.env().insert(makeNormalForm(var));
+    stack.emplace_back(Continuation::Abstract, true, args.size(), value);
+    control = Object(Expression::at(value.expr().body), frame);
+    goto enter;
+  }
+  {
+    STATS(Stats::depth(stack.size()));
+    Continuation k(stack.back());
+    stack.pop_back();
+    switch( k.kind ){
+      case Continuation::Done:
+        return value;
+      case Continuation::Update:
+        updateThunk(k.slot[0], value);
+        break;
+      case Continuation::Neutral:
+        {
+          Expression expr2(Expression::Ap);
+          expr2.body = Expression::make(k.obj.expr());
+          expr2.arg = Expression::make(value.expr());
+          value = makeNormalForm( expr2 );
+        }
+        break;
+      case Continuation::Abstract:
+        {
+          Expression expr2(k.obj.expr());
+          expr2.body = Expression::make(value.expr());
+          value = makeNormalForm( expr2 );
+        }
+        break;
+      case Continuation::Bind:
+        control = k.obj.bind(value);
+        goto enter;
+    }
+    goto deliver;
+  }
+#undef DISPATCH
+}
+
+void Bytecode::sweep(){
+  for(uint32_t i = 1; i < blocks.size(); ++i){
+    Block& block = blocks[i];
+    // Free already, or its expression was freed and the tag reset
+    if(block.arg == Expression::null || Expression::tag(block.arg) == i) continue;
+    block.body = block.arg = Expression::null;
+    vector<Instruction>().swap(block.code);
+    freeBlocks.push_back(i);
+  }
+}
+
+namespace{
+
+// Queue the blocks of the applications reachable from `expr` without
+// going through another application
+void reach(const Expression * expr, vector<uint32_t>& queue, vector<bool>& seen){
+  while(expr->isLam())
+    expr = &Expression::at(expr->body);
+  if(!expr->isAp()) return ;
+  uint32_t i = blockOf(*expr);
+  if(seen.size() <= i) seen.resize(i + 1);
+  if(seen[i]) return ;
+  seen[i] = true;
+  queue.push_back(i);
+}
+
+string describe(const Expression& expr){
+  switch(expr.type){
+    case Expression::Var:
+      return symbolName(expr.name);
+    case Expression::Lambda:
+      return "\\" + symbolName(expr.name);
+    case Expression::Ap:
+      return "block " + to_string(blockOf(expr));
+    case Expression::Constant:
+    case Expression::Nothing:
+      break;
+  }
+  return "";
+}
+
+}
+
+void Bytecode::dump(const Expression& expr, ostream& out){
+  vector<uint32_t> queue;
+  vector<bool> seen;
+  reach(&expr, queue, seen);
+  for(size_t q = 0; q < queue.size(); ++q){
+    out << "block " << queue[q] << ":" << endl;
+    // Compiling may move the blocks, copy the code out
+    vector<Instruction> code = blocks[queue[q]].code;
+    for(const Instruction& ins : code){
+      out << "    " << left << setw(12) << opNames[ins.op];
+      if(ins.op == Instruction::Call)
+        out << ins.count << " ";
+      out << ins.operand;
+      if(ins.op == Instruction::PushThunk || ins.op == Instruction::Free || ins.op == Instruction::Closure || ins.op == Instruction::Call){
+        const Expression& e = Expression::at(ins.operand);
+        out << "\t; " << describe(e);
+        reach(&e, queue, seen);
+      }
+      out << endl;
+    }
+  }
+}
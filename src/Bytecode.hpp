@@ -0,0 +1,42 @@
+#ifndef __ULC_BYTECODE_HPP__
+#define __ULC_BYTECODE_HPP__
+
+#include <iostream>
+
+#include "Runtime.hpp"
+
+// Bytecode compiler and interpreter.
+//
+// Every application spine `h a1 .. an` compiles once into a block: the
+// arguments are pushed as thunks, last one first, and a final instruction
+// enters the head. Lambda bodies are entered by binding the argument on
+// top of the stack; when the head is a lambda written in place, as a `let`
+// is, its lazy lambdas take their arguments in one `CALL`. Blocks are
+// compiled lazily, cached per expression and run by a direct-threaded
+// interpreter loop. Thunks are updated through the continuation `ENTER`
+// pushes, as a variable names a thunk of any block.
+//
+// Instructions
+//   PUSH_CONST  v   push the constant `v` as an argument
+//   PUSH_THUNK  e   push a thunk of expression `e` in the current context
+//   ENTER       i   force variable `i`, updating it, and apply it
+//   FREE        e   the free variable `e` is the head
+//   CONST       v   the constant `v` is the head
+//   CLOSURE     e   a closure of the lambda `e` is the head
+//   CALL        n e bind the `n` arguments on top to the first `n` lambdas
+//                   of `e`, none of them strict, and enter its body
+namespace Bytecode{
+
+// Evaluate to normal form if `strong`, else to weak head normal form
+Object evaluate(const Expression& expr, const Context& env, bool strong);
+
+// Free the blocks of the expressions the collector freed, called by the
+// collector after its sweep
+void sweep();
+
+// Compile `expr` and everything it contains, then print the blocks
+void dump(const Expression& expr, std::ostream&);
+
+}
+
+#endif
@@ -0,0 +1,735 @@
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Codegen.hpp"
+#include "Graph.hpp"
+
+using namespace std;
+using namespace Graph;
+
+namespace{
+
+// The runtime, before the program. The kinds of nodes are those of
+// `Graph::Kind`, in the same order.
+const char * const head = R"(#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+typedef uint32_t Id;
+
+enum{APP, NUM, FREE, GLOBAL, PRIM, IND, HOLE, DEAD};
+
+typedef struct{
+  uint8_t kind, marked, busy;
+  /* App: the function and the argument; Num: the value; Free: the name */
+  uint32_t a, b;
+} Node;
+
+#define NONE ((Id)-1)
+
+static Node * nodes;
+static Id used, capacity;
+/* Dead nodes, linked through `a` */
+static Id freeList = NONE;
+static size_t allocated;
+/* Collect once this many nodes were allocated, or as many as were live */
+static size_t threshold = 1 << 20;
+
+/* Buffered IO, as in the interpreter */
+static char output[64 << 10];
+static size_t outputUsed;
+static char input[64 << 10];
+static size_t inputBegin, inputEnd;
+static int inputClosed;
+
+static void writeOut(void){
+  size_t done = 0;
+  while(done < outputUsed){
+    ssize_t n = write(STDOUT_FILENO, output + done, outputUsed - done);
+    if(n < 0 && errno == EINTR) continue;
+    if(n < 0){
+      outputUsed = 0;
+      fputs("[IO] Cannot write the output\n", stderr);
+      exit(1);
+    }
+    done += n;
+  }
+  outputUsed = 0;
+}
+
+static void put(int c){
+  if(outputUsed == sizeof output)
+    writeOut();
+  output[outputUsed++] = c;
+}
+
+static int get(void){
+  if(inputBegin == inputEnd){
+    writeOut();
+    if(inputClosed) return -1;
+    while(1){
+      ssize_t n = read(STDIN_FILENO, input, sizeof input);
+      if(n < 0 && errno == EINTR) continue;
+      if(n <= 0){
+        inputClosed = 1;
+        return -1;
+      }
+      inputBegin = 0;
+      inputEnd = n;
+      break;
+    }
+  }
+  return (unsigned char)input[inputBegin++];
+}
+
+static void fail(const char * message){
+  fprintf(stderr, "[Graph] %s\n", message);
+  exit(1);
+}
+
+static void * grow(void * array, size_t * size, size_t item){
+  *size = *size ? 2 * *size : 1 << 10;
+  array = realloc(array, *size * item);
+  if(!array) fail("Out of memory");
+  return array;
+}
+
+static Id make(uint8_t kind, uint32_t a, uint32_t b){
+  Id n;
+  ++allocated;
+  if(freeList != NONE){
+    n = freeList;
+    freeList = nodes[n].a;
+  }else{
+    if(used == capacity){
+      size_t size = capacity;
+      nodes = grow(nodes, &size, sizeof(Node));
+      capacity = size;
+    }
+    n = used++;
+  }
+  nodes[n].kind = kind;
+  nodes[n].marked = 0;
+  nodes[n].busy = 0;
+  nodes[n].a = a;
+  nodes[n].b = b;
+  return n;
+}
+
+static Id app(Id f, Id x){ return make(APP, f, x);}
+static Id num(int v){ return make(NUM, (uint32_t)v, 0);}
+static Id var(uint32_t name){ return make(FREE, name, 0);}
+
+static Id deref(Id n){
+  while(nodes[n].kind == IND)
+    n = nodes[n].a;
+  return n;
+}
+
+static void update(Id target, uint8_t kind, uint32_t a, uint32_t b){
+  nodes[target].kind = kind;
+  nodes[target].a = a;
+  nodes[target].b = b;
+}
+
+/* Overwrite `target` with an indirection to `value` */
+static void redirect(Id target, Id value){
+  value = deref(value);
+  if(value == target) fail("<<loop>>");
+  update(target, IND, value, 0);
+}
+
+/* Overwrite `target` with the application of `f` to `x` */
+static void apply(Id target, Id f, Id x){
+  if(deref(f) == target) fail("<<loop>>");
+  update(target, APP, f, x);
+}
+
+/* Instantiates its body in place of `redex`, given its arguments */
+typedef void (*Code)(Id redex, const Id * a);
+
+typedef struct{
+  int arity;
+  /* Arguments taken by the variables it captures, before its lambdas */
+  int captured;
+  Code code;
+  /* Of its lambdas */
+  const uint32_t * names;
+} Supercombinator;
+
+enum{OP_FIX, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_EQ, OP_LT, OP_LE,
+  OP_PUT_CHAR, OP_GET_CHAR, OP_GET_LINE, OP_GET_CONTENTS, OP_FLUSH};
+
+typedef struct{
+  int op;
+  int arity;
+  uint32_t name;
+} Primitive;
+
+)";
+
+// The runtime, after the program
+const char * const tail = R"(
+/* The spines being unwound, one above the other: the evaluation of an
+   argument of a primitive saves where the spine of the primitive starts */
+typedef struct{
+  size_t base;
+  Id node;
+} Frame;
+
+static Id * stack;
+static size_t stackSize, stackCapacity;
+static Frame * dump;
+static size_t dumpSize, dumpCapacity;
+/* Nodes held by the readback */
+static Id * pinned;
+static size_t pinnedSize, pinnedCapacity;
+static Id * pending;
+static size_t pendingCapacity;
+static Id args[MAX_ARITY];
+
+static void push(Id n){
+  if(stackSize == stackCapacity)
+    stack = grow(stack, &stackCapacity, sizeof(Id));
+  stack[stackSize++] = n;
+}
+
+static void pin(Id n){
+  if(pinnedSize == pinnedCapacity)
+    pinned = grow(pinned, &pinnedCapacity, sizeof(Id));
+  pinned[pinnedSize++] = n;
+}
+
+static void collect(void){
+  size_t count = 0, live = 0, i;
+  Id n;
+#define MARK(node) do{ \
+    if(count == pendingCapacity) pending = grow(pending, &pendingCapacity, sizeof(Id)); \
+    pending[count++] = (node); \
+  }while(0)
+  for(i = 0; i < stackSize; ++i) MARK(stack[i]);
+  for(i = 0; i < pinnedSize; ++i) MARK(pinned[i]);
+  for(i = 0; i < sizeof roots / sizeof *roots; ++i) MARK(roots[i]);
+  while(count){
+    Node * node = &nodes[pending[--count]];
+    if(node->marked) continue;
+    node->marked = 1;
+    if(node->kind == APP){
+      MARK(node->a);
+      MARK(node->b);
+    }else if(node->kind == IND){
+      MARK(node->a);
+    }
+  }
+#undef MARK
+  freeList = NONE;
+  for(n = used; n-- > 0; ){
+    if(nodes[n].marked){
+      nodes[n].marked = 0;
+      ++live;
+    }else{
+      nodes[n].kind = DEAD;
+      nodes[n].a = freeList;
+      freeList = n;
+    }
+  }
+  allocated = 0;
+  threshold = live > (1 << 20) ? live : 1 << 20;
+}
+
+/* A free variable reads as -1, as in the interpreter */
+static int number(Id n){
+  return nodes[n].kind == NUM ? (int)nodes[n].a : -1;
+}
+
+/* pair a s, what an IO action returns */
+static Id result(Id a, Id s){
+  return app(app(RESULT, a), s);
+}
+
+/* The list of the characters read up to `end`, -1 for the end of the input */
+static Id readList(int end){
+  char * bytes = NULL;
+  size_t size = 0, capacity = 0;
+  Id list = NIL;
+  int c;
+  for(c = get(); c != -1 && c != end; c = get()){
+    if(size == capacity)
+      bytes = grow(bytes, &capacity, 1);
+    bytes[size++] = c;
+  }
+  while(size-- > 0)
+    list = app(app(CONS, num((unsigned char)bytes[size])), list);
+  free(bytes);
+  return list;
+}
+
+/* The operands are numbers or the world, the first one first */
+static Id call(const Primitive * prim, const Id * operands){
+  int x, y;
+  switch(prim->op){
+    case OP_ADD: return num((int)((unsigned)number(operands[0]) + (unsigned)number(operands[1])));
+    case OP_SUB: return num((int)((unsigned)number(operands[0]) - (unsigned)number(operands[1])));
+    case OP_MUL:
+      x = number(operands[0]);
+      if(x == 0) return num(0);
+      return num((int)((unsigned)x * (unsigned)number(operands[1])));
+    case OP_DIV:
+    case OP_MOD:
+      x = number(operands[0]);
+      y = number(operands[1]);
+      if(y == 0) fail("Division by zero");
+      return num(prim->op == OP_DIV ? x / y : x % y);
+    case OP_EQ: return number(operands[0]) == number(operands[1]) ? YES : NO;
+    case OP_LT: return number(operands[0]) < number(operands[1]) ? YES : NO;
+    case OP_LE: return number(operands[0]) <= number(operands[1]) ? YES : NO;
+    case OP_PUT_CHAR:
+      put(number(operands[0]));
+      return result(var(NIL_NAME), operands[1]);
+    case OP_GET_CHAR: return result(num(get()), operands[0]);
+    case OP_GET_LINE: return result(readList('\n'), operands[0]);
+    case OP_GET_CONTENTS: return result(readList(-1), operands[0]);
+    case OP_FLUSH:
+      writeOut();
+      return result(var(NIL_NAME), operands[0]);
+  }
+  fail("Unknown primitive");
+  return NONE;
+}
+
+/* Reduce `root` to weak head normal form, return the node it became */
+static Id whnf(Id root){
+  size_t floor = dumpSize, base = stackSize;
+  push(root);
+  while(1){
+    Id top, value;
+    Node node;
+    size_t count, last;
+    if(allocated >= threshold)
+      collect();
+    top = stack[stackSize - 1];
+    node = nodes[top];
+    count = stackSize - 1 - base;
+    switch(node.kind){
+      case IND:
+        stack[stackSize - 1] = deref(top);
+        continue;
+      case APP:
+        push(node.a);
+        continue;
+      case GLOBAL:
+        {
+          const Supercombinator * sc = &supercombinators[node.a];
+          int i;
+          if(count < (size_t)sc->arity) break;
+          last = stackSize - 1;
+          for(i = 0; i < sc->arity; ++i)
+            args[i] = nodes[stack[last - 1 - i]].b;
+          sc->code(stack[last - sc->arity], args);
+          stackSize = last - sc->arity + 1;
+          continue;
+        }
+      case PRIM:
+        {
+          const Primitive * prim = &primitives[node.a];
+          Id operands[2], redex;
+          int i, ready = 1;
+          if(count < (size_t)prim->arity) break;
+          last = stackSize - 1;
+          redex = stack[last - prim->arity];
+          if(prim->op == OP_FIX){
+            /* Y f = f (Y f), the application itself being `Y f` */
+            update(redex, APP, nodes[stack[last - 1]].b, redex);
+            stackSize = last;
+            continue;
+          }
+          for(i = 0; i < prim->arity && ready; ++i){
+            Id arg = deref(nodes[stack[last - 1 - i]].b);
+            uint8_t kind = nodes[arg].kind;
+            operands[i] = arg;
+            if(kind == NUM || kind == FREE) continue;
+            if(i == 1 && prim->op == OP_MUL && number(operands[0]) == 0 && nodes[operands[0]].kind == NUM) continue;
+            if(nodes[arg].busy) fail("<<loop>>");
+            nodes[arg].busy = 1;
+            if(dumpSize == dumpCapacity)
+              dump = grow(dump, &dumpCapacity, sizeof(Frame));
+            dump[dumpSize].base = base;
+            dump[dumpSize].node = arg;
+            ++dumpSize;
+            base = stackSize;
+            push(arg);
+            ready = 0;
+          }
+          if(!ready) continue;
+          redirect(redex, call(prim, operands));
+          stackSize = last - prim->arity + 1;
+          continue;
+        }
+      case NUM:
+      case FREE:
+        break;
+      default:
+        fail("Unexpected node");
+    }
+    /* Weak head normal form */
+    value = deref(stack[base]);
+    stackSize = base;
+    if(dumpSize == floor)
+      return value;
+    if(nodes[value].kind != NUM && nodes[value].kind != FREE)
+      fail("A primitive needs a number");
+    --dumpSize;
+    nodes[dump[dumpSize].node].busy = 0;
+    base = dump[dumpSize].base;
+  }
+}
+
+enum{TERM_VAR, TERM_NUM, TERM_LAMBDA, TERM_AP};
+
+/* A normal form */
+typedef struct Term{
+  int kind;
+  /* The value of a number, the name of a variable or of a lambda */
+  uint32_t value;
+  struct Term * body, * arg;
+} Term;
+
+static Term * term(int kind, uint32_t value, Term * body, Term * arg){
+  Term * t = malloc(sizeof(Term));
+  if(!t) fail("Out of memory");
+  t->kind = kind;
+  t->value = value;
+  t->body = body;
+  t->arg = arg;
+  return t;
+}
+
+/* Normal form of the graph at `n` */
+static Term * readback(Id n){
+  size_t held = pinnedSize, first, count;
+  Id value, head;
+  Node node;
+  Term * t;
+  pin(n);
+  value = head = whnf(n);
+  first = pinnedSize;
+  while(nodes[head].kind == APP){
+    pin(nodes[head].b);
+    head = deref(nodes[head].a);
+  }
+  /* The arguments, the last one first */
+  count = pinnedSize - first;
+  node = nodes[head];
+  if(node.kind == GLOBAL && count < (size_t)supercombinators[node.a].arity){
+    /* A lambda, its variable stays a free, named variable */
+    const Supercombinator * sc = &supercombinators[node.a];
+    uint32_t name = sc->names[count - sc->captured];
+    Id v = var(name);
+    pin(v);
+    t = term(TERM_LAMBDA, name, readback(app(value, v)), NULL);
+  }else{
+    if(node.kind == NUM)
+      t = term(TERM_NUM, node.a, NULL, NULL);
+    else if(node.kind == FREE)
+      t = term(TERM_VAR, node.a, NULL, NULL);
+    else if(node.kind == PRIM)
+      t = term(TERM_VAR, primitives[node.a].name, NULL, NULL);
+    else
+      fail("Unexpected node");
+    while(count-- > 0)
+      t = term(TERM_AP, 0, t, readback(pinned[first + count]));
+  }
+  pinnedSize = held;
+  return t;
+}
+
+static void print(const Term * t){
+  int parens;
+  switch(t->kind){
+    case TERM_VAR:
+      fputs(names[t->value], stdout);
+      break;
+    case TERM_NUM:
+      printf("%d", (int)t->value);
+      break;
+    case TERM_LAMBDA:
+      printf("\\%s ", names[t->value]);
+      print(t->body);
+      break;
+    case TERM_AP:
+      parens = t->body->kind == TERM_LAMBDA || t->body->kind == TERM_AP;
+      if(parens) putchar('(');
+      print(t->body);
+      if(parens) putchar(')');
+      putchar(' ');
+      parens = t->arg->kind == TERM_LAMBDA || t->arg->kind == TERM_AP;
+      if(parens) putchar('(');
+      print(t->arg);
+      if(parens) putchar(')');
+      break;
+  }
+}
+
+int main(int argc, char * argv[]){
+  int printResult = 0, i;
+  Term * normalForm;
+  for(i = 1; i < argc; ++i){
+    if(strcmp(argv[i], "--print") == 0){
+      printResult = 1;
+    }else{
+      fprintf(stderr, "[Main] Unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  atexit(writeOut);
+  used = capacity = sizeof image / sizeof *image;
+  nodes = malloc(capacity * sizeof(Node));
+  if(!nodes) fail("Out of memory");
+  memcpy(nodes, image, sizeof image);
+  normalForm = readback(ROOT);
+  writeOut();
+  if(printResult){
+    print(normalForm);
+    putchar('\n');
+  }
+  return 0;
+}
+)";
+
+// The C primitive of each native
+struct Operation{
+  const char * native;
+  const char * op;
+};
+const Operation operations[] = {
+  {"+", "OP_ADD"},
+  {"-", "OP_SUB"},
+  {"*", "OP_MUL"},
+  {"/", "OP_DIV"},
+  {"mod", "OP_MOD"},
+  {"==", "OP_EQ"},
+  {"<", "OP_LT"},
+  {"<=", "OP_LE"},
+  {"putChar", "OP_PUT_CHAR"},
+  {"getChar", "OP_GET_CHAR"},
+  {"getLine", "OP_GET_LINE"},
+  {"getContents", "OP_GET_CONTENTS"},
+  {"flush", "OP_FLUSH"},
+};
+
+const char * const kinds[] = {"APP", "NUM", "FREE", "GLOBAL", "PRIM", "IND", "HOLE", "DEAD"};
+
+class Writer{
+    const Image& image;
+    ostream& out;
+    // The names of the program, by their index in the C table
+    vector<Symbol> names;
+    unordered_map<Symbol, uint32_t> indices;
+    // The slots read by the supercombinator being written, its `let`s
+    // binding the others are dropped
+    vector<bool> used;
+
+  public:
+    Writer(const Image& i, ostream& o) : image(i), out(o) {}
+
+    uint32_t name(Symbol symbol){
+      auto it = indices.find(symbol);
+      if(it != indices.end()) return it->second;
+      names.push_back(symbol);
+      return indices[symbol] = names.size() - 1;
+    }
+
+    void use(const Supercombinator& sc, uint32_t code){
+      const Op& o = sc.code[code];
+      switch(o.kind){
+        case Op::Slot:
+          used[o.a] = true;
+          break;
+        case Op::App:
+          use(sc, o.a);
+          use(sc, o.b);
+          break;
+        case Op::Let:
+          // The value only reads the slots bound before it
+          use(sc, o.c);
+          if(used[o.a]) use(sc, o.b);
+          break;
+        default:
+          break;
+      }
+    }
+
+    // C expression building `code`, the `let`s it binds declared first
+    string build(const Supercombinator& sc, uint32_t code, string& lets){
+      const Op& o = sc.code[code];
+      switch(o.kind){
+        case Op::Slot:
+          return (int)o.a < sc.arity ? "a[" + to_string(o.a) + "]" : "l" + to_string(o.a);
+        case Op::Num:
+          return "num(" + to_string((int)o.a) + ")";
+        case Op::Free:
+          return "var(" + to_string(name(o.a)) + ")";
+        case Op::Node:
+          return to_string(o.a);
+        case Op::App:
+          {
+            string f = build(sc, o.a, lets);
+            return "app(" + f + ", " + build(sc, o.b, lets) + ")";
+          }
+        case Op::Let:
+          if(!used[o.a])
+            return build(sc, o.c, lets);
+          {
+            string value = build(sc, o.b, lets);
+            lets += "  Id l" + to_string(o.a) + " = " + value + ";\n";
+            return build(sc, o.c, lets);
+          }
+      }
+      return string();
+    }
+
+    void function(size_t index){
+      const Supercombinator& sc = image.supercombinators[index];
+      string body;
+      used.assign(sc.frame, false);
+      use(sc, sc.root);
+      uint32_t code = sc.root;
+      for(; sc.code[code].kind == Op::Let; code = sc.code[code].c){
+        if(!used[sc.code[code].a]) continue;
+        string value = build(sc, sc.code[code].b, body);
+        body += "  Id l" + to_string(sc.code[code].a) + " = " + value + ";\n";
+      }
+      const Op& o = sc.code[code];
+      string last;
+      if(o.kind == Op::Num){
+        last = "update(r, NUM, (uint32_t)" + to_string((int)o.a) + ", 0);";
+      }else if(o.kind == Op::Free){
+        last = "update(r, FREE, " + to_string(name(o.a)) + ", 0);";
+      }else if(o.kind == Op::App){
+        string f = build(sc, o.a, body);
+        string x = build(sc, o.b, body);
+        last = "apply(r, " + f + ", " + x + ");";
+      }else{
+        last = "redirect(r, " + build(sc, code, body) + ");";
+      }
+      out << "static void sc" << index << "(Id r, const Id * a){\n" << body << "  " << last << "\n}\n\n";
+      out << "static const uint32_t names" << index << "[] = {";
+      int lambdas = sc.arity - sc.captured.size();
+      for(int i = 0; i < lambdas; ++i)
+        out << name(sc.names[i]) << ", ";
+      out << "0};\n\n";
+    }
+
+    void write(){
+      out << head;
+      // Used by putChar and flush
+      name(intern("nil"));
+      int maxArity = 2;
+      for(size_t i = 0; i < image.supercombinators.size(); ++i){
+        function(i);
+        maxArity = max(maxArity, image.supercombinators[i].arity);
+      }
+      out << "static const Supercombinator supercombinators[] = {\n";
+      for(size_t i = 0; i < image.supercombinators.size(); ++i){
+        const Supercombinator& sc = image.supercombinators[i];
+        out << "  {" << sc.arity << ", " << sc.captured.size() << ", sc" << i << ", names" << i << "},\n";
+      }
+      out << "  {0, 0, NULL, NULL}\n};\n\n";
+
+      out << "static const Primitive primitives[] = {\n";
+      for(const Primitive& prim : image.primitives){
+        const char * op = "OP_FIX";
+        if(!prim.fix){
+          const Operation * it = find_if(begin(operations), end(operations), [&prim](const Operation& o){
+            return strcmp(o.native, prim.native->name) == 0;
+          });
+          if(it == end(operations)){
+            cerr << "[Codegen] No C code for the native " << prim.native->name << endl;
+            exit(1);
+          }
+          op = it->op;
+        }
+        out << "  {" << op << ", " << prim.arity << ", " << name(intern(prim.fix ? "Y" : prim.native->name)) << "},\n";
+      }
+      out << "  {0, 0, 0}\n};\n\n";
+
+      out << "static const Node image[] = {\n";
+      for(const Node& node : image.nodes){
+        uint32_t a = node.kind == Kind::Free ? name(node.a) : node.a;
+        out << "  {" << kinds[(int)node.kind] << ", 0, 0, " << a << "u, " << node.b << "u},\n";
+      }
+      out << "};\n\n";
+
+      out << "static const Id roots[] = {";
+      for(Id n : image.globals)
+        out << n << ", ";
+      for(const Supercombinator& sc : image.supercombinators)
+        out << sc.global << ", ";
+      out << image.root << "};\n\n";
+
+      out << "static const char * const names[] = {\n";
+      for(Symbol symbol : names){
+        out << "  \"";
+        for(char c : symbolName(symbol)){
+          if(c == '"' || c == '\\') out << '\\';
+          out << c;
+        }
+        out << "\",\n";
+      }
+      out << "};\n\n";
+
+      out << "#define MAX_ARITY " << maxArity << "\n";
+      out << "#define ROOT " << image.root << "\n";
+      out << "#define YES " << image.yes << "\n";
+      out << "#define NO " << image.no << "\n";
+      out << "#define RESULT " << image.result << "\n";
+      out << "#define NIL " << image.nil << "\n";
+      out << "#define CONS " << image.cons << "\n";
+      out << "#define NIL_NAME 0\n";
+      out << tail;
+    }
+};
+
+}
+
+void Codegen::write(const Expression& expr, const Context& env, ostream& out){
+  Writer(Graph::image(expr, env), out).write();
+}
+
+bool Codegen::compile(const Expression& expr, const Context& env, const char * path){
+  char source[] = "/tmp/ulc-XXXXXX.c";
+  int fd = mkstemps(source, 2);
+  if(fd < 0) return false;
+  close(fd);
+  {
+    ofstream file(source);
+    write(expr, env, file);
+    if(!file){
+      unlink(source);
+      return false;
+    }
+  }
+  const char * cc = getenv("CC");
+  if(!cc || !*cc) cc = "cc";
+  pid_t pid = fork();
+  if(pid == 0){
+    execlp(cc, cc, "-O2", "-o", path, source, (char *)nullptr);
+    _exit(127);
+  }
+  int status = 0;
+  bool built = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  unlink(source);
+  return built;
+}
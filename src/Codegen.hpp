@@ -0,0 +1,32 @@
+#ifndef __ULC_CODEGEN_HPP__
+#define __ULC_CODEGEN_HPP__
+
+#include <ostream>
+
+#include "Runtime.hpp"
+
+// Compilation of a program to C, ahead of time.
+//
+// The program and the prelude it uses are lifted into supercombinators as
+// by the graph engine, each one becoming a C function that instantiates
+// its body in place of the application it reduces. The C source carries
+// the initial graph and a graph-reduction runtime: the spineless machine
+// of the graph engine, its collector, and the arithmetic, comparison and
+// IO natives with the same world-token protocol and buffered IO as the
+// interpreter. The executable prints the normal form of the program when
+// given --print.
+//
+// There are no governor limits in the executable, and `par` does not
+// spark.
+namespace Codegen{
+
+// Write the C source of `expr` in `env`
+void write(const Expression& expr, const Context& env, std::ostream& out);
+
+// Build the executable `path` from `expr` in `env` with the C compiler
+// named by $CC, `cc` by default; false if it fails
+bool compile(const Expression& expr, const Context& env, const char * path);
+
+}
+
+#endif
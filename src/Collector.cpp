@@ -0,0 +1,149 @@
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include "Collector.hpp"
+#include "Runtime.hpp"
+#include "Parallel.hpp"
+#include "Governor.hpp"
+#include "Bytecode.hpp"
+
+using namespace std;
+
+namespace{
+
+const size_t MinThreshold = 4 << 20;
+
+size_t heapLimit = 0;
+size_t threshold = MinThreshold;
+size_t allocatedAtLastCollection = 0;
+Collector::Stats collectorStats = Collector::Stats();
+
+size_t allocatedBytes(){
+  return Heap::stats().bytesAllocated + Expression::allocationCount() * sizeof(Expression);
+}
+
+}
+
+void Collector::poll(){
+  // Only the main thread collects
+  if(Heap::concurrent && Parallel::self() != 0)
+    return ;
+  if(allocatedBytes() - allocatedAtLastCollection >= threshold)
+    collect();
+}
+
+void Collector::collect(){
+  using Frame = Context::Frame;
+  // The other threads must keep off the heap meanwhile, collect later if
+  // some are evaluating
+  if(Heap::concurrent && !Parallel::pause())
+    return ;
+  auto start = chrono::steady_clock::now();
+  vector<Frame *> frames;
+  unsigned lists = __atomic_load_n(&LiveList<Frame>::count, __ATOMIC_ACQUIRE);
+  for(unsigned i = 0; i < lists; ++i)
+    for(Frame * frame = LiveList<Frame>::lists[i]->head; frame; frame = frame->nextLive)
+      frames.push_back(frame);
+
+  // Count the references each frame gets from other frames
+  for(Frame * frame : frames){
+    frame->internalRefs = 0;
+    frame->marked = false;
+  }
+  for(Frame * frame : frames){
+    if(frame->next) frame->next->internalRefs += 1;
+    if(frame->value._env._frames) frame->value._env._frames->internalRefs += 1;
+  }
+
+  vector<Frame *> stack;
+  for(Frame * frame : frames){
+    if(frame->refs > frame->internalRefs)
+      stack.push_back(frame);
+  }
+  auto markObject = [&stack](const Object& obj){
+    const Expression& expr = obj._expr;
+    if(expr.isLam() || expr.isAp()) Expression::mark(expr.body);
+    if(expr.isAp()) Expression::mark(expr.arg);
+    if(obj._env._frames) stack.push_back(obj._env._frames.get());
+  };
+  lists = __atomic_load_n(&LiveList<Object>::count, __ATOMIC_ACQUIRE);
+  for(unsigned i = 0; i < lists; ++i)
+    for(Object * obj = LiveList<Object>::lists[i]->head; obj; obj = obj->nextLive)
+      markObject(*obj);
+  while(!stack.empty()){
+    Frame * frame = stack.back();
+    stack.pop_back();
+    if(frame->marked) continue;
+    frame->marked = true;
+    markObject(frame->value);
+    if(frame->next) stack.push_back(frame->next.get());
+  }
+
+  size_t expressionsFreed = Expression::sweep();
+  Bytecode::sweep();
+
+  // Whatever frame is left unmarked is only referenced by other such
+  // frames, hold on to all of them while their links are cut.
+  vector<Frame *> garbage;
+  for(Frame * frame : frames){
+    if(!frame->marked){
+      garbage.push_back(frame);
+      frame->refs += 1;
+    }
+  }
+  for(Frame * frame : garbage){
+    frame->value = Object(Expression());
+    frame->next = Ref<Frame>();
+  }
+  for(Frame * frame : garbage){
+    if(frame->drop() == 0)
+      Heap::destroy(frame);
+  }
+  if(Heap::concurrent)
+    Parallel::resume();
+
+  double pause = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  collectorStats.collections += 1;
+  collectorStats.framesFreed += garbage.size();
+  collectorStats.expressionsFreed += expressionsFreed;
+  collectorStats.totalPause += pause;
+  if(pause > collectorStats.maxPause)
+    collectorStats.maxPause = pause;
+
+  size_t live = liveBytes();
+  if(heapLimit && live > heapLimit){
+    cerr << "[Governor] Heap limit exceeded: " << live << " bytes live, limit is " << heapLimit << endl;
+    Governor::stop(Governor::OutOfMemory);
+  }
+  allocatedAtLastCollection = allocatedBytes();
+  threshold = max(MinThreshold, live);
+  if(heapLimit)
+    threshold = min(threshold, max(heapLimit / 4, (size_t)1));
+}
+
+size_t Collector::liveBytes(){
+  return Heap::stats().bytesLive + Expression::liveCount() * sizeof(Expression);
+}
+
+void Collector::setHeapLimit(size_t bytes){
+  heapLimit = bytes;
+  threshold = max(MinThreshold, liveBytes());
+  if(heapLimit)
+    threshold = min(threshold, max(heapLimit / 4, (size_t)1));
+}
+
+const Collector::Stats& Collector::stats(){
+  return collectorStats;
+}
+
+void Collector::printStats(ostream& out){
+  const Stats& s = collectorStats;
+  out << "[GC] collections: " << s.collections
+      << ", frames freed: " << s.framesFreed
+      << ", expressions freed: " << s.expressionsFreed
+      << ", total pause: " << s.totalPause * 1000 << "ms"
+      << ", max pause: " << s.maxPause * 1000 << "ms"
+      << ", live: " << liveBytes() << " bytes" << endl;
+}
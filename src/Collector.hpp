@@ -0,0 +1,46 @@
+#ifndef __ULC_COLLECTOR_HPP__
+#define __ULC_COLLECTOR_HPP__
+
+#include <cstddef>
+#include <iostream>
+
+// Tracing collector over the frames of the runtime heap and the
+// expression pool.
+//
+// Roots are the objects living outside of the heap (on the evaluator's
+// stack or captured by primitives) and every frame that is referenced
+// from outside the heap, which shows as a reference count larger than
+// the number of references coming from other frames. Frames nothing
+// reaches are reference cycles and get broken, unmarked expressions go
+// back to the pool.
+//
+// Reference counting frees most frames as soon as they are dropped, this
+// collector only has the cycles left. It neither copies nor compacts:
+// evaluators hold frames and their slots by address across calls, so
+// frames stay where they were allocated. Their blocks go back to the free
+// lists of the heap, which reuse them for the next frame of their size;
+// the chunks reserved at the peak of a run are kept until it ends.
+class Collector{
+  public:
+    struct Stats{
+      size_t collections;
+      size_t framesFreed;
+      size_t expressionsFreed;
+      double totalPause;
+      double maxPause;
+    };
+
+    // Collect once enough was allocated since the last collection
+    static void poll();
+    static void collect();
+
+    // Bytes held by frames and expressions
+    static size_t liveBytes();
+    // 0 for no limit
+    static void setHeapLimit(size_t bytes);
+
+    static const Stats& stats();
+    static void printStats(std::ostream&);
+};
+
+#endif
@@ -1,111 +1,162 @@
 #ifndef __SILVERNEGI_TRIE_HPP__
 #define __SILVERNEGI_TRIE_HPP__
 
+#include <iostream>
+#include <cstdint>
 #include <string>
 #include <memory>
-#include <unordered_map>
+#include <vector>
+#include <functional>
 
 namespace{
 
 using namespace std;
 
-template <class T>
-class Trie{
+// Persistent hash array mapped trie.
+// Every node consumes 5 bits of the key's hash, a bitmap tells which of the
+// 32 slots are present and `entries` holds only those, in slot order.
+// Updates copy the nodes along one path and share everything else.
+// Once the hash is used up the node degrades to a plain collision list.
+template <class T, class Key>
+class HashTrie{
   public:
-    unordered_map<char, shared_ptr<Trie<T>>> branches;
-    bool endHere;
-    T cargo;
+    static const int Bits = 5;
+    static const uint32_t Mask = (1u << Bits) - 1;
 
-    Trie() : endHere(false) {}
-    Trie(const T& t) : cargo(t) {}
+    struct Entry{
+      // Null for a leaf
+      shared_ptr<const HashTrie> child;
+      Key key;
+      T cargo;
+    };
 
-    bool exist(const string& str, int i = 0) const {
-      if(i == str.size()){
-        return endHere;
+    uint32_t bitmap;
+    vector<Entry> entries;
+
+    HashTrie() : bitmap(0) {}
+
+    static bool collision(int shift) { return shift >= 32;}
+    static uint32_t bit(size_t hash, int shift) { return 1u << ((hash >> shift) & Mask);}
+    int slot(uint32_t b) const { return __builtin_popcount(bitmap & (b - 1));}
+
+    const T* find(const Key& key, size_t hash, int shift = 0) const {
+      const HashTrie * node = this;
+      while(!collision(shift)){
+        uint32_t b = bit(hash, shift);
+        if(!(node->bitmap & b)) return nullptr;
+        const Entry& entry = node->entries[node->slot(b)];
+        if(!entry.child)
+          return entry.key == key ? &entry.cargo : nullptr;
+        node = entry.child.get();
+        shift += Bits;
       }
-      char c = str[i];
-      auto branch = branches.find(c);
-      if(branch != branches.end()){
-        return branch->second->exist(str, i+1);
-      }else{
-        return false;
+      for(const Entry& entry : node->entries){
+        if(entry.key == key) return &entry.cargo;
       }
+      return nullptr;
     }
 
-    const T& find(const string& str, int i = 0) const {
-      if(i == str.size()){
-        if(endHere){
-          return cargo;
-        }else{
-          cerr << "[Trie] Nothing here" << endl;
-          exit(1);
+    shared_ptr<const HashTrie> insert(const Key& key, size_t hash, const T& t, int shift = 0) const {
+      shared_ptr<HashTrie> newNode(new HashTrie(*this));
+      if(collision(shift)){
+        for(Entry& entry : newNode->entries){
+          if(entry.key == key){
+            entry.cargo = t;
+            return newNode;
+          }
         }
+        newNode->entries.push_back(Entry{nullptr, key, t});
+        return newNode;
       }
-      char c = str[i];
-      auto branch = branches.find(c);
-      if(branch != branches.end()){
-        return branch->second->find(str, i+1);
-      }else{
-        cerr << "[Trie] Nothing here" << endl;
-        exit(1);
+      uint32_t b = bit(hash, shift);
+      int i = slot(b);
+      if(!(bitmap & b)){
+        newNode->bitmap |= b;
+        newNode->entries.insert(newNode->entries.begin() + i, Entry{nullptr, key, t});
+        return newNode;
       }
-    }
-
-    shared_ptr<Trie<T>> insert(const string& str, const T& t, int i = 0) const {
-      shared_ptr<Trie<T>> newNode(new Trie<T>(*this));
-      if(i == str.size()){
-        newNode->endHere = true;
-        newNode->cargo = t;
+      Entry& entry = newNode->entries[i];
+      if(entry.child){
+        entry.child = entry.child->insert(key, hash, t, shift + Bits);
+      }else if(entry.key == key){
+        entry.cargo = t;
       }else{
-        char c = str[i];
-        auto branch = branches.find(c);
-        if(branch != branches.end()){
-          newNode->branches[c] = branch->second->insert(str, t, i+1);
-        }else{
-          shared_ptr<Trie<T>> empty(new Trie<T>());
-          newNode->branches[c] = empty->insert(str, t, i+1);
-        }
+        // Push the old leaf one level down, next to the new one
+        HashTrie empty;
+        auto child = empty.insert(entry.key, std::hash<Key>()(entry.key), entry.cargo, shift + Bits);
+        entry.child = child->insert(key, hash, t, shift + Bits);
       }
       return newNode;
     }
 
-    shared_ptr<Trie<T>> erase(const string& str, int i = 0) const {
-      shared_ptr<Trie<T>> newNode(new Trie<T>(*this));
-      if(i == str.size()){
-        newNode->endHere = false;
-      }else{
-        char c = str[i];
-        auto branch = branches.find(c);
-        if(branch != branches.end()){
-          newNode->branches[c] = branch->second->erase(str, i+1);
+    shared_ptr<const HashTrie> erase(const Key& key, size_t hash, int shift = 0) const {
+      if(collision(shift)){
+        for(size_t i = 0; i < entries.size(); ++i){
+          if(entries[i].key == key){
+            shared_ptr<HashTrie> newNode(new HashTrie(*this));
+            newNode->entries.erase(newNode->entries.begin() + i);
+            return newNode;
+          }
         }
+        return nullptr;
+      }
+      uint32_t b = bit(hash, shift);
+      if(!(bitmap & b)) return nullptr;
+      int i = slot(b);
+      const Entry& entry = entries[i];
+      shared_ptr<HashTrie> newNode;
+      if(entry.child){
+        auto child = entry.child->erase(key, hash, shift + Bits);
+        if(!child) return nullptr;
+        newNode.reset(new HashTrie(*this));
+        if(child->entries.empty()){
+          newNode->bitmap &= ~b;
+          newNode->entries.erase(newNode->entries.begin() + i);
+        }else{
+          newNode->entries[i].child = child;
+        }
+      }else{
+        if(!(entry.key == key)) return nullptr;
+        newNode.reset(new HashTrie(*this));
+        newNode->bitmap &= ~b;
+        newNode->entries.erase(newNode->entries.begin() + i);
       }
       return newNode;
     }
 };
 
-template<class T>
+template<class T, class Key = string>
 class Dictionary{
-    shared_ptr<Trie<T>> _trie;
+    shared_ptr<const HashTrie<T, Key>> _trie;
+
+    static size_t hash(const Key& key) { return std::hash<Key>()(key);}
   public:
-    Dictionary() : _trie(new Trie<T>()) {}
-    Dictionary(const shared_ptr<Trie<T>>& t) : _trie(t) {}
+    Dictionary() {}
+    Dictionary(const shared_ptr<const HashTrie<T, Key>>& t) : _trie(t) {}
     Dictionary(const Dictionary& dict) : _trie(dict._trie) {}
 
-    const T& operator [] (const string& str) const {
-      return _trie->find(str);
+    const T& operator [] (const Key& key) const {
+      const T * res = _trie ? _trie->find(key, hash(key)) : nullptr;
+      if(res == nullptr){
+        cerr << "[Dictionary] Nothing here" << endl;
+        exit(1);
+      }
+      return *res;
     }
 
-    bool exist(const string& str) const {
-      return _trie->exist(str);
+    bool exist(const Key& key) const {
+      return _trie && _trie->find(key, hash(key)) != nullptr;
     }
 
-    Dictionary insert(const string& str, const T& t) const {
-      return _trie->insert(str, t);
+    Dictionary insert(const Key& key, const T& t) const {
+      if(!_trie) return HashTrie<T, Key>().insert(key, hash(key), t);
+      return _trie->insert(key, hash(key), t);
     }
 
-    Dictionary erase(const string& str) const {
-      return _trie->erase(str);
+    Dictionary erase(const Key& key) const {
+      if(!_trie) return *this;
+      auto res = _trie->erase(key, hash(key));
+      return res ? Dictionary(res) : *this;
     }
 };
 
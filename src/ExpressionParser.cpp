@@ -7,242 +7,537 @@
 #include <vector>
 #include <deque>
 #include <memory>
+#include <unordered_map>
+#include <mutex>
 #include <sstream>
 
 #include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "ExpressionParser.hpp"
 #include "Parsers.hpp"
+#include "Json.hpp"
+#include "Heap.hpp"
 
 using namespace std;
 
-using Parsers::Parser;
+using Parsers::Iterator;
 using Parsers::satisfy;
 using Parsers::anyChar;
-using Parsers::spaces;
 using Parsers::oneOf;
-using Parsers::noneOf;
 using Parsers::digit;
 using Parsers::charp;
-using Parsers::word;
-
-const Parser alpha(satisfy([](char c){
-  return isgraph(c) && c != '\\' && c != '(' && c != ')';
-}));
-
-const Parser integer(maybe(oneOf("+-")) >> +digit);
-const Parser charLiteral(charp('\'') >> satisfy([](char c){ return isprint(c);}) >> charp('\''));
-const Parser identifier(+alpha);
-const Parser lambda('\\');
-const Parser leftBracket('(');
-const Parser rightBracket(')');
-const Parser comment(word("--") >> many(noneOf("\n")));
-const Parser panic(anyChar[ ([](const string& str){ cerr << "[Lex] Unexpected input: " << str << endl;}) ]);
-
-Parser tokenParser(Token& token){
-  auto f = [&token](Token::Type t){
-    return [&token, t](const string& str){ token = Token(t, str);};
-  };
-  auto g = [&token](const string& str){
-    if(str == "let") token = Token(Token::Keyword, "let");
-    else if(str == "in") token = Token(Token::Keyword, "in");
-    else token = Token(Token::Identifier, str);
-  };
-  return (comment[f(Token::Undefined)]
-      | integer[f(Token::Constant)]
-      | charLiteral[f(Token::Constant)]
-      | identifier[g]
-      | lambda[f(Token::Lambda)]
-      | leftBracket[f(Token::LeftBracket)]
-      | rightBracket[f(Token::RightBracket)]
-      | panic[f(Token::Undefined)]
-      );
-}
-
-Scanner::Scanner(const string& buffer){
-  auto first = buffer.begin(), last = buffer.end();
+
+namespace{
+
+struct IsAlpha{ bool operator () (char c) const { return isgraph(c) && c != '\\' && c != '(' && c != ')';}};
+struct IsPrint{ bool operator () (char c) const { return isprint(c);}};
+
+const auto alpha = satisfy(IsAlpha());
+const auto integer = maybe(oneOf("+-")) >> +digit;
+const auto charLiteral = charp('\'') >> satisfy(IsPrint()) >> charp('\'');
+const auto identifier = +alpha;
+const auto lambda = charp('\\');
+const auto leftBracket = charp('(');
+const auto rightBracket = charp(')');
+
+// Stores the range parsed as the token
+class Found{
+    Token& token;
+    Token::Type type;
+  public:
+    Found(Token& t, Token::Type u) : token(t), type(u) {}
+    void operator () (Iterator first, Iterator last) const { token = Token(type, first, last);}
+};
+
+class FoundName{
+    Token& token;
+  public:
+    explicit FoundName(Token& t) : token(t) {}
+    void operator () (Iterator first, Iterator last) const {
+      token = Token(Token::Identifier, first, last);
+      if(token.is("let") || token.is("in")) token.type = Token::Keyword;
+    }
+};
+
+class Panic{
+    Token& token;
+  public:
+    explicit Panic(Token& t) : token(t) {}
+    void operator () (Iterator first, Iterator last) const {
+      cerr << "[Lex] Unexpected input: " << string(first, last) << endl;
+      token = Token(Token::Undefined, first, last);
+    }
+};
+
+}
+
+namespace{
+
+const char * const endOfFile = "EOF";
+
+const char * skipSpaces(const char * first, const char * last){
+#if defined(__SSE2__)
+  // Sixteen bytes at a time while they are all blank
+  const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), newline = _mm_set1_epi8('\n');
+  while(last - first >= 16){
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+    __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)), _mm_cmpeq_epi8(chunk, newline));
+    unsigned others = ~_mm_movemask_epi8(blank) & 0xFFFF;
+    if(others) return first + __builtin_ctz(others);
+    first += 16;
+  }
+#endif
+  while(first != last && (*first == ' ' || *first == '\t' || *first == '\n'))
+    ++first;
+  return first;
+}
+
+// Skip the blanks and the comments before the next token
+const char * skip(const char * first, const char * last){
+  while(true){
+    first = skipSpaces(first, last);
+    if(last - first < 2 || first[0] != '-' || first[1] != '-')
+      return first;
+    const char * newline = static_cast<const char *>(memchr(first, '\n', last - first));
+    first = newline ? newline : last;
+  }
+}
+
+}
+
+Scanner::Scanner() : current(0), cursor(nullptr), hasLookahead(false) {}
+
+Scanner::Scanner(const string& buffer) : Scanner() {
+  addBuffer(string(buffer));
+}
+
+Scanner::~Scanner(){
+  for(Source& source : sources)
+    if(source.mapping)
+      munmap(source.mapping, source.mappedLength);
+}
+
+void Scanner::addBuffer(string&& buffer){
+  buffers.push_back(std::move(buffer));
+  const string& text = buffers.back();
+  sources.push_back(Source{text.data(), text.data() + text.size(), nullptr, 0});
+}
+
+namespace{
+
+// Everything left to read from `fd`
+string readAll(int fd){
+  const size_t Block = 64 << 10;
+  string buffer;
+  size_t used = 0;
+  while(true){
+    buffer.resize(used + Block);
+    ssize_t n = read(fd, &buffer[used], Block);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) break;
+    used += n;
+  }
+  buffer.resize(used);
+  return buffer;
+}
+
+}
+
+bool Scanner::addFile(const char * path){
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return false;
+  struct stat status;
+  if(fstat(fd, &status) < 0){
+    close(fd);
+    return false;
+  }
+  // Pipes and devices have no size, they are read to their end
+  if(!S_ISREG(status.st_mode)){
+    addBuffer(readAll(fd));
+    close(fd);
+    return true;
+  }
+  size_t length = status.st_size;
+  if(length == 0){
+    close(fd);
+    return true;
+  }
+  void * mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(mapping == MAP_FAILED){
+    addBuffer(readAll(fd));
+    close(fd);
+    return true;
+  }
+  close(fd);
+  madvise(mapping, length, MADV_SEQUENTIAL);
+  const char * text = static_cast<const char *>(mapping);
+  sources.push_back(Source{text, text + length, mapping, length});
+  return true;
+}
+
+void Scanner::addText(const string& text){
+  addBuffer(string(text));
+}
+
+void Scanner::addStandardInput(){
+  addBuffer(readAll(STDIN_FILENO));
+}
+
+Token Scanner::scan(){
   Token token;
-  while(first != last){
-    tie(ignore, first) = spaces.runParser(first, last);
-    if(first == last) break;
-    tie(ignore, first) = tokenParser(token).runParser(first, last);
+  while(current < sources.size()){
+    const char * last = sources[current].last;
+    if(!cursor) cursor = sources[current].first;
+    cursor = skip(cursor, last);
+    if(cursor == last){
+      ++current;
+      cursor = nullptr;
+      continue;
+    }
+    const auto tokenParser = integer[Found(token, Token::Constant)]
+      | charLiteral[Found(token, Token::Constant)]
+      | identifier[FoundName(token)]
+      | lambda[Found(token, Token::Lambda)]
+      | leftBracket[Found(token, Token::LeftBracket)]
+      | rightBracket[Found(token, Token::RightBracket)]
+      | anyChar[Panic(token)];
+    tokenParser(cursor, last);
     if(token.type != Token::Undefined)
-      tokens.push_back(token);
+      return token;
   }
+  return Token(Token::EndOfFile, endOfFile, endOfFile + 3);
 }
 
 Token Scanner::getToken(){
-  if(tokens.empty()) return Token(Token::EndOfFile, "EOF");
-  Token token = tokens.front();
-  tokens.pop_front();
-  return token;
+  if(hasLookahead){
+    hasLookahead = false;
+    return lookahead;
+  }
+  return scan();
 }
 
 Token Scanner::peekToken(){
-  if(tokens.empty()) return Token(Token::EndOfFile, "EOF");
-  return tokens.front();
+  if(!hasLookahead){
+    lookahead = scan();
+    hasLookahead = true;
+  }
+  return lookahead;
 }
 
+// Only the last token read can be put back
 void Scanner::ungetToken(const Token& token){
   if(token.type == Token::EndOfFile) return ;
-  tokens.push_front(token);
+  lookahead = token;
+  hasLookahead = true;
 }
 
-bool Scanner::eof() const {
-  return tokens.empty();
+bool Scanner::eof(){
+  return peekToken().type == Token::EndOfFile;
+}
+
+namespace{
+
+// Names are kept in a deque so the references handed out stay valid
+class SymbolTable{
+    deque<string> names;
+    unordered_map<string, Symbol> symbols;
+    mutable SpinLock lock;
+  public:
+    SymbolTable() { intern("");}
+
+    Symbol intern(const string& str){
+      lock_guard<SpinLock> guard(lock);
+      auto it = symbols.find(str);
+      if(it != symbols.end()) return it->second;
+      Symbol sym = names.size();
+      names.push_back(str);
+      symbols[str] = sym;
+      return sym;
+    }
+
+    const string& operator [] (Symbol sym) const {
+      lock_guard<SpinLock> guard(lock);
+      return names[sym];
+    }
+};
+
+// Expressions are allocated in fixed-size chunks so a reference into the
+// pool stays valid while the pool grows. Freed slots are chained through
+// their `body` and have type `Nothing`.
+// The chunk table is reserved up front: other threads index it without
+// the lock while it grows.
+class ExpressionPool{
+    static const int ChunkBits = 12;
+    static const Expression::Ref ChunkMask = (1u << ChunkBits) - 1;
+    vector<unique_ptr<Expression[]>> chunks;
+    Expression::Ref size;
+    Expression::Ref freeList;
+    vector<bool> marks;
+    SpinLock lock;
+  public:
+    // One word per expression for the evaluators, cleared on reuse
+    vector<uint32_t> tags;
+    size_t live;
+    size_t allocations;
+
+    ExpressionPool() : size(0), freeList(Expression::null), live(0), allocations(0) {
+      chunks.reserve(1u << 16);
+      make(Expression());
+    }
+
+    Expression::Ref make(const Expression& expr){
+      lock_guard<SpinLock> guard(lock);
+      ++live;
+      ++allocations;
+      if(freeList != Expression::null){
+        Expression::Ref ref = freeList;
+        freeList = (*this)[ref].body;
+        (*this)[ref] = expr;
+        return ref;
+      }
+      if((size & ChunkMask) == 0)
+        chunks.emplace_back(new Expression[1u << ChunkBits]);
+      chunks.back()[size & ChunkMask] = expr;
+      return size++;
+    }
+
+    Expression& operator [] (Expression::Ref ref){
+      return chunks[ref >> ChunkBits][ref & ChunkMask];
+    }
+
+    void mark(Expression::Ref ref){
+      marks.resize(size);
+      vector<Expression::Ref> stack(1, ref);
+      while(!stack.empty()){
+        ref = stack.back();
+        stack.pop_back();
+        if(ref == Expression::null || marks[ref]) continue;
+        marks[ref] = true;
+        const Expression& expr = (*this)[ref];
+        if(expr.isLam() || expr.isAp()) stack.push_back(expr.body);
+        if(expr.isAp()) stack.push_back(expr.arg);
+      }
+    }
+
+    size_t sweep(){
+      marks.resize(size);
+      size_t freed = 0;
+      for(Expression::Ref ref = 1; ref < size; ++ref){
+        Expression& expr = (*this)[ref];
+        if(!marks[ref] && expr.type != Expression::Nothing){
+          expr = Expression();
+          if(ref < tags.size()) tags[ref] = 0;
+          expr.body = freeList;
+          freeList = ref;
+          ++freed;
+        }
+      }
+      live -= freed;
+      marks.assign(size, false);
+      return freed;
+    }
+};
+
+SymbolTable& symbolTable(){
+  static SymbolTable table;
+  return table;
+}
+
+ExpressionPool& expressionPool(){
+  static ExpressionPool pool;
+  return pool;
+}
+
+}
+
+Symbol intern(const string& str){
+  return symbolTable().intern(str);
+}
+
+const string& symbolName(Symbol sym){
+  return symbolTable()[sym];
+}
+
+Expression::Ref Expression::make(const Expression& expr){
+  return expressionPool().make(expr);
+}
+
+Expression& Expression::at(Expression::Ref ref){
+  return expressionPool()[ref];
+}
+
+void Expression::mark(Expression::Ref ref){
+  expressionPool().mark(ref);
+}
+
+size_t Expression::sweep(){
+  return expressionPool().sweep();
+}
+
+uint32_t& Expression::tag(Expression::Ref ref){
+  ExpressionPool& pool = expressionPool();
+  if(ref >= pool.tags.size())
+    pool.tags.resize(ref + 1);
+  return pool.tags[ref];
+}
+
+size_t Expression::liveCount(){
+  return expressionPool().live;
+}
+
+size_t Expression::allocationCount(){
+  return expressionPool().allocations;
 }
 
 void Expression::print() const {
-  switch(type){
-    case Constant:
-      cout << "[\"int\"," << val << "]";
-      break;
-    case Var:
-      cout << "[\"var\",\"" << name << "\"]";
-      break;
-    case Lambda:
-      cout << "[\"lam\",\"" << name << "\",";
-      body->print();
-      cout << "]";
-      break;
-    case Ap:
-      cout << "[\"app\",";
-      body->print();
-      cout << ",";
-      arg->print();
-      cout << "]";
-      break;
-    case Nothing:
-      cerr << "[Expression] Unexpected expression type: Nothing" << endl;
-  }
+  Json::write(*this, cout);
 }
 
 void Expression::prettyPrint() const {
   switch(type){
     case Var:
-      cout << name;
+      cout << symbolName(name);
       return ;
     case Constant:
       cout << val;
       return ;
     case Lambda:
-      cout << "\\" << name << " ";
-      body->prettyPrint();
+      cout << "\\" << symbolName(name) << " ";
+      at(body).prettyPrint();
       return ;
     case Ap:
-      if(body->isLam() || body->isAp()) cout << "(";
-      body->prettyPrint();
-      if(body->isLam() || body->isAp()) cout << ")";
-      cout << " ";
-      if(arg->isLam() || arg->isAp()) cout << "(";
-      arg->prettyPrint();
-      if(arg->isLam() || arg->isAp()) cout << ")";
+      {
+        const Expression& lhs = at(body);
+        const Expression& rhs = at(arg);
+        if(lhs.isLam() || lhs.isAp()) cout << "(";
+        lhs.prettyPrint();
+        if(lhs.isLam() || lhs.isAp()) cout << ")";
+        cout << " ";
+        if(rhs.isLam() || rhs.isAp()) cout << "(";
+        rhs.prettyPrint();
+        if(rhs.isLam() || rhs.isAp()) cout << ")";
+      }
       return ;
     case Nothing:
       cerr << "[Expression] Unexpected expression type: Nothing" << endl;
   }
 }
 
-template<class T>
-T stringTo(const string& str){
-  istringstream iss(str);
-  T res;
-  iss >> res;
-  return res;
+// The value of an integer token, an optional sign and digits
+int integerValue(const Token& token){
+  const char * p = token.text, * last = token.text + token.length;
+  bool negative = *p == '-';
+  if(*p == '-' || *p == '+') ++p;
+  unsigned res = 0;
+  for(; p != last; ++p)
+    res = res * 10 + (*p - '0');
+  return negative ? -res : res;
 }
 
-Expression * parseExpressionTail(Scanner&);
+Expression::Ref parseExpressionTail(Scanner&);
 
-Expression * parseExpression(Scanner &scanner){
-  Expression * expr(parseExpressionTail(scanner));
-  if(expr == nullptr){
-    cerr << "[Parse expression] Unexpected token: " << scanner.peekToken().name << endl;
+Expression::Ref parseExpression(Scanner &scanner){
+  Expression::Ref expr(parseExpressionTail(scanner));
+  if(expr == Expression::null){
+    cerr << "[Parse expression] Unexpected token: " << scanner.peekToken().name() << endl;
     exit(1);
-    return nullptr;
+    return Expression::null;
   }
   while(true){
-    Expression * expr1(parseExpressionTail(scanner));
-    if(expr1 == nullptr){
+    Expression::Ref expr1(parseExpressionTail(scanner));
+    if(expr1 == Expression::null){
       return expr;
     }else{
-      Expression * expr2(new Expression(Expression::Ap));
-      expr2->body = expr;
-      expr2->arg  = expr1;
-      expr = expr2;
+      Expression expr2(Expression::Ap);
+      expr2.body = expr;
+      expr2.arg  = expr1;
+      expr = Expression::make(expr2);
     }
   }
 }
 
-Expression * parseExpressionTail(Scanner &scanner){
+Expression::Ref parseExpressionTail(Scanner &scanner){
   Token token = scanner.getToken();
-  Expression * expr(nullptr);
   switch(token.type){
     case Token::Lambda:
-      token = scanner.getToken();
-      if(token.type != Token::Identifier){
-        cerr << "[Parse] Expected an identifier: " << token.name << endl;
-        exit(1);
+      {
+        token = scanner.getToken();
+        if(token.type != Token::Identifier){
+          cerr << "[Parse] Expected an identifier: " << token.name() << endl;
+          exit(1);
+        }
+        Expression expr(Expression::Lambda);
+        expr.name = intern(token.name());
+        expr.body = parseExpression(scanner);
+        return Expression::make(expr);
       }
-      expr = new Expression(Expression::Lambda);
-      expr->name = token.name;
-      expr->body = parseExpression(scanner);
-      return expr;
 
     case Token::Identifier:
-      expr = new Expression(Expression::Var);
-      expr->name = token.name;
-      return expr;
+      return Expression::make(Expression(token.name()));
 
     case Token::Keyword:
-      if(token.name == "let"){
+      if(token.is("let")){
         token = scanner.getToken();
         if(token.type != Token::Identifier){
-          cerr << "[Parse] Expected an identifier: " << token.name << endl;
+          cerr << "[Parse] Expected an identifier: " << token.name() << endl;
           exit(1);
         }
-        expr = new Expression(Expression::Ap);
-        expr->body = new Expression(Expression::Lambda);
-        expr->body->name = token.name;
-        expr->arg = parseExpression(scanner);
+        Expression lam(Expression::Lambda);
+        lam.name = intern(token.name());
+        Expression expr(Expression::Ap);
+        expr.arg = parseExpression(scanner);
         token = scanner.getToken();
-        if(token.type != Token::Keyword || token.name != "in"){
-          cerr << "[Parse] Expected a keyword `in`: " << token.name << endl;
+        if(token.type != Token::Keyword || !token.is("in")){
+          cerr << "[Parse] Expected a keyword `in`: " << token.name() << endl;
           exit(1);
         }
-        expr->body->body = parseExpression(scanner);
-        return expr;
-      }else if(token.name == "in"){
+        lam.body = parseExpression(scanner);
+        expr.body = Expression::make(lam);
+        return Expression::make(expr);
+      }else if(token.is("in")){
         scanner.ungetToken(token);
-        return nullptr;
+        return Expression::null;
       }
 
     case Token::Constant:
-      expr = new Expression(Expression::Constant);
-      expr->name = token.name;
-      if(token.name[0] == '\''){
-        // character literal
-        expr->val = (int)token.name[1];
-      }else{
-        expr->val = stringTo<int>(token.name);
+      {
+        Expression expr(Expression::Constant);
+        if(token.text[0] == '\''){
+          // character literal
+          expr.val = (int)token.text[1];
+        }else{
+          expr.val = integerValue(token);
+        }
+        return Expression::make(expr);
       }
-      return expr;
 
     case Token::LeftBracket:
-      expr = parseExpression(scanner);
-      token = scanner.getToken();
-      if(token.type != Token::RightBracket){
-        cerr << "[Parse] Expected a `)`: " << token.name << endl;
-        exit(1);
+      {
+        Expression::Ref expr = parseExpression(scanner);
+        token = scanner.getToken();
+        if(token.type != Token::RightBracket){
+          cerr << "[Parse] Expected a `)`: " << token.name() << endl;
+          exit(1);
+        }
+        return expr;
       }
-      return expr;
 
     case Token::RightBracket:
       scanner.ungetToken(token);
-      return nullptr;
+      return Expression::null;
 
     case Token::EndOfFile:
     default:
-      return nullptr;
+      return Expression::null;
   }
 }
-
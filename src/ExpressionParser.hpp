@@ -2,49 +2,106 @@
 #define __PARSE_ULC_EXPRESSION_HPP__
 
 #include <cstdlib>
+#include <cstdint>
 #include <string>
 #include <algorithm>
 #include <functional>
 #include <deque>
+#include <vector>
 #include <sstream>
 
 class Token{
   public:
     enum Type{Undefined, Constant, Identifier, Keyword, Lambda, LeftBracket, RightBracket, EndOfFile} type;
-    std::string name;
+    // Points into the source held by the scanner
+    const char * text;
+    size_t length;
 
-    Token() : type(Undefined), name() {}
-    Token(const std::string& str) : type(Undefined), name(str) {}
-    Token(Type t) : type(t), name() {}
-    Token(Type t, const std::string& str) : type(t), name(str) {}
+    Token() : type(Undefined), text(""), length(0) {}
+    Token(Type t, const char * first, const char * last) : type(t), text(first), length(last - first) {}
+
+    std::string name() const { return std::string(text, length);}
+    bool is(const char * word) const { return length == std::char_traits<char>::length(word) && std::equal(text, text + length, word);}
 };
 
+// Tokens are scanned on demand from a sequence of sources, read one after
+// the other. Files are memory-mapped and the standard input is read in
+// blocks, tokens point into them instead of copying their text.
 class Scanner{
   private:
-    std::deque<Token> tokens;
+    struct Source{
+      const char * first;
+      const char * last;
+      // Set if the source is a mapped file
+      void * mapping;
+      size_t mappedLength;
+    };
+    std::vector<Source> sources;
+    // The sources given as strings or read from the standard input
+    std::deque<std::string> buffers;
+    size_t current;
+    const char * cursor;
+    // A token peeked or put back
+    Token lookahead;
+    bool hasLookahead;
+
+    void addBuffer(std::string&&);
+    Token scan();
   public:
-    Scanner(const std::string&);
+    Scanner();
+    explicit Scanner(const std::string&);
+    Scanner(const Scanner&) = delete;
+    Scanner& operator = (const Scanner&) = delete;
+    ~Scanner();
+
+    // Append the file at `path`, false if it cannot be read
+    bool addFile(const char * path);
+    // Append the rest of the standard input
+    void addStandardInput();
+    // Append `text`
+    void addText(const std::string& text);
 
     Token getToken();
     Token peekToken();
     void ungetToken(const Token&);
-    bool eof() const ;
+    bool eof();
 };
 
+// Identifiers are interned, a `Symbol` indexes the symbol table.
+// Symbol 0 is the empty name.
+using Symbol = uint32_t;
+
+Symbol intern(const std::string&);
+const std::string& symbolName(Symbol);
+
+// Expressions are small fixed-size records living in one pool, children
+// refer to each other by their index in that pool.
 class Expression{
   public:
-    enum Type{Nothing, Var, Constant, Lambda, Ap} type;
+    using Ref = uint32_t;
+    // Ref 0 never holds an expression
+    static const Ref null = 0;
 
-    int val;
-    std::string name;
-    Expression * body;
-    Expression * arg;
+    enum Type : uint8_t {Nothing, Var, Constant, Lambda, Ap} type;
 
-    Expression() : type(Nothing), name(), body(), arg() {}
-    Expression(Type t) : type(t), name(), body(), arg() {}
-    Expression(int v) : type(Constant), val(v), name() {}
-    Expression(const std::string& str) : type(Var), name(str) {}
-    Expression(const Expression& expr) : type(expr.type), val(expr.val), name(expr.name), body(expr.body), arg(expr.arg) {}
+    union{
+      // Value of a `Constant`
+      int val;
+      // de Bruijn index of a `Var`, -1 if the variable is free
+      int index;
+      // Of a `Lambda`: its body evaluates its variable once it and the
+      // `strict - 1` lambdas right below it are applied, set by the
+      // strictness analysis; not at all if 0 or less
+      int strict;
+    };
+    Symbol name;
+    Ref body;
+    Ref arg;
+
+    Expression() : type(Nothing), val(0), name(), body(), arg() {}
+    Expression(Type t) : type(t), index(-1), name(), body(), arg() {}
+    Expression(int v) : type(Constant), val(v), name(), body(), arg() {}
+    Expression(const std::string& str) : type(Var), index(-1), name(intern(str)), body(), arg() {}
 
     bool isVar() const { return type == Var;}
     bool isLam() const { return type == Lambda;}
@@ -53,9 +110,24 @@ class Expression{
 
     void print() const ;
     void prettyPrint() const ;
+
+    // Store a copy of `expr` in the pool
+    static Ref make(const Expression& expr);
+    static Expression& at(Ref);
+
+    // Collector support: mark what is reachable from `ref`, then sweep
+    // frees every unmarked expression and returns how many were freed.
+    static void mark(Ref ref);
+    static size_t sweep();
+    static size_t liveCount();
+    static size_t allocationCount();
+
+    // A word attached to the expression at `ref` by the evaluators, it is
+    // reset to 0 once the expression is freed.
+    static uint32_t& tag(Ref);
 };
 
-Expression * parseExpression(Scanner&);
+Expression::Ref parseExpression(Scanner&);
 
 #endif
 
@@ -0,0 +1,94 @@
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <chrono>
+#include <new>
+
+#include <sys/resource.h>
+
+#include "Governor.hpp"
+#include "Collector.hpp"
+#include "Parallel.hpp"
+#include "IO.hpp"
+
+using namespace std;
+
+namespace{
+
+using Clock = chrono::steady_clock;
+
+// Reductions between two looks at the clock
+const size_t Interval = 4096;
+
+// Stack kept for what runs past the last check: natives, the collector,
+// the allocator
+const size_t StackMargin = 256 << 10;
+thread_local size_t stackSize = 0;
+
+const size_t Unlimited = numeric_limits<size_t>::max();
+
+size_t fuelEnd = Unlimited;
+bool timed = false;
+Clock::time_point deadline;
+Governor::Limits current = Governor::Limits();
+
+void outOfMemory(){
+  cerr << "[Governor] Out of memory" << endl;
+  Governor::stop(Governor::OutOfMemory);
+}
+
+}
+
+size_t Governor::checkpoint = Unlimited;
+thread_local const char * Governor::stackEnd = nullptr;
+
+void Governor::start(const Limits& limits){
+  current = limits;
+  fuelEnd = limits.fuel ? reductions + limits.fuel : Unlimited;
+  timed = limits.seconds > 0;
+  if(timed)
+    deadline = Clock::now() + chrono::duration_cast<Clock::duration>(chrono::duration<double>(limits.seconds));
+  checkpoint = timed ? min(fuelEnd, reductions + Interval) : fuelEnd;
+  Collector::setHeapLimit(limits.heapBytes);
+  set_new_handler(outOfMemory);
+  rlimit stack;
+  if(getrlimit(RLIMIT_STACK, &stack) == 0 && stack.rlim_cur != RLIM_INFINITY)
+    guardStack(stack.rlim_cur);
+  else
+    guardStack(0);
+}
+
+void Governor::guardStack(size_t size){
+  char here;
+  stackSize = size;
+  stackEnd = size > StackMargin ? &here - (size - StackMargin) : nullptr;
+}
+
+void Governor::outOfStack(){
+  Parallel::fizzle();
+  cerr << "[Governor] Out of stack: recursion deeper than the " << (stackSize >> 10) << " KB stack" << endl;
+  stop(OutOfStack);
+}
+
+void Governor::check(){
+  if(reductions >= fuelEnd){
+    cerr << "[Governor] Out of fuel: " << current.fuel << " reductions" << endl;
+    stop(OutOfFuel);
+  }
+  if(timed && Clock::now() >= deadline){
+    cerr << "[Governor] Out of time: " << current.seconds << "s" << endl;
+    stop(OutOfTime);
+  }
+  checkpoint = timed ? min(fuelEnd, reductions + Interval) : fuelEnd;
+}
+
+void Governor::stop(Status status){
+  IO::flush();
+  // Other threads may still be evaluating, leave without tearing down
+  // what they use
+  if(Parallel::threads() > 1){
+    cout.flush();
+    quick_exit(status);
+  }
+  exit(status);
+}
@@ -0,0 +1,65 @@
+#ifndef __ULC_GOVERNOR_HPP__
+#define __ULC_GOVERNOR_HPP__
+
+#include <cstddef>
+
+#include "Runtime.hpp"
+
+// Limits on an evaluation: reductions, live heap bytes and wall time.
+//
+// The engines count their reductions through `step`, which only leaves
+// the fast path at a checkpoint: once the fuel runs out, or every few
+// thousand reductions while a deadline is set to look at the clock. The
+// heap is checked by the collector after each collection. The evaluators
+// recursing on the C++ stack check its depth through `deep`. An
+// evaluation going over a limit is stopped with a message and the status
+// of that limit, the output written so far flushed.
+namespace Governor{
+
+// Exit statuses, 1 for the errors of the program itself
+enum Status{
+  Failure = 1,
+  OutOfFuel = 3,
+  OutOfMemory = 4,
+  OutOfTime = 5,
+  OutOfStack = 6
+};
+
+// 0 for no limit in each
+struct Limits{
+  size_t fuel;
+  size_t heapBytes;
+  double seconds;
+};
+
+// Apply `limits` to what is evaluated from now on
+void start(const Limits& limits);
+
+// Reductions at which `check` is due
+extern size_t checkpoint;
+void check();
+
+inline void step(){
+  if(++reductions >= checkpoint) check();
+}
+
+// The calling thread runs on a stack of `size` bytes, its top about here;
+// 0 for no limit. Called by `start` for the calling thread.
+void guardStack(size_t size);
+
+// Where the recursion of the calling thread has to stop, the stack
+// growing down
+extern thread_local const char * stackEnd;
+[[noreturn]] void outOfStack();
+
+inline void deep(){
+  char here;
+  if(&here < stackEnd) outOfStack();
+}
+
+// Flush the output and leave with `status`
+[[noreturn]] void stop(Status status);
+
+}
+
+#endif
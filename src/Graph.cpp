@@ -0,0 +1,674 @@
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+
+#include "Graph.hpp"
+#include "Stats.hpp"
+#include "Governor.hpp"
+
+using namespace std;
+using namespace Graph;
+
+namespace{
+
+// Primitives standing for lambda terms, as in the net engine. `putStr` is
+// given `Y` and `putChar`.
+struct Term{
+  const char * name;
+  const char * source;
+};
+const Term terms[] = {
+  {":", "\\x \\xs \\s \\z s x xs"},
+  {"head", "\\x x (\\a \\_ a) _"},
+  {"tail", "\\x x (\\_ \\b b) _"},
+  {"empty?", "\\x x (\\_ \\_ \\a \\b b) (\\a \\b a)"},
+  {"par", "\\a \\b b"},
+  {"putStr", "\\Y \\putChar Y (\\putStr \\str \\s str (\\c \\cs \\s putChar c s (\\_ \\s putStr cs s)) (\\s \\p p nil s) s)"},
+};
+
+// Collect once this many nodes were allocated, or as many as were live
+const size_t MinCollection = 1 << 20;
+
+class Reducer{
+    vector<Node> nodes;
+    vector<Id> freeNodes;
+    size_t allocated = 0;
+    size_t threshold = MinCollection;
+    // Nodes made and freed since the heap statistics were last told
+    size_t made = 0, freed = 0;
+
+    vector<Supercombinator> supercombinators;
+    vector<Primitive> primitives;
+    unordered_map<const Native *, Id> natives;
+    Id fixNode = 0;
+    bool hasFix = false;
+    // Nodes living as long as the reducer
+    vector<Id> globals;
+    // Nodes held by the readback
+    vector<Id> pinned;
+
+    // The spines being unwound, one above the other: the evaluation of an
+    // argument of a primitive saves where the spine of the primitive starts
+    struct Frame{
+      size_t base;
+      Id node;
+    };
+    vector<Id> stack;
+    vector<Frame> dump;
+    // Slots of the supercombinator being instantiated
+    vector<Id> locals;
+
+  public:
+    // Where `putStr` finds `putChar`
+    Context prelude;
+
+    ~Reducer(){
+      freed += nodes.size() - freeNodes.size();
+      account();
+    }
+
+    void account(){
+      Heap::account(made, freed, sizeof(Node));
+      made = freed = 0;
+    }
+
+    Id make(Kind kind, uint32_t a, uint32_t b = 0){
+      ++allocated;
+      ++made;
+      Node node = {kind, false, false, a, b};
+      if(!freeNodes.empty()){
+        Id n = freeNodes.back();
+        freeNodes.pop_back();
+        nodes[n] = node;
+        return n;
+      }
+      nodes.push_back(node);
+      return nodes.size() - 1;
+    }
+
+    Id deref(Id n) const {
+      while(nodes[n].kind == Kind::Ind)
+        n = nodes[n].a;
+      return n;
+    }
+
+    // Overwrite `target` with an indirection to `value`
+    void redirect(Id target, Id value){
+      value = deref(value);
+      if(value == target){
+        cerr << "[Graph] <<loop>>" << endl;
+        exit(1);
+      }
+      nodes[target] = Node{Kind::Ind, false, false, value, 0};
+    }
+
+    void collect(){
+      vector<Id> pending(stack);
+      pending.insert(pending.end(), pinned.begin(), pinned.end());
+      pending.insert(pending.end(), globals.begin(), globals.end());
+      for(const Supercombinator& sc : supercombinators)
+        pending.push_back(sc.global);
+      while(!pending.empty()){
+        Id n = pending.back();
+        pending.pop_back();
+        Node& node = nodes[n];
+        if(node.marked) continue;
+        node.marked = true;
+        if(node.kind == Kind::App){
+          pending.push_back(node.a);
+          pending.push_back(node.b);
+        }else if(node.kind == Kind::Ind){
+          pending.push_back(node.a);
+        }
+      }
+      freeNodes.clear();
+      size_t live = 0;
+      for(Id n = 0; n < nodes.size(); ++n){
+        if(nodes[n].marked){
+          nodes[n].marked = false;
+          ++live;
+        }else{
+          if(nodes[n].kind != Kind::Dead) ++freed;
+          nodes[n].kind = Kind::Dead;
+          freeNodes.push_back(n);
+        }
+      }
+      account();
+      allocated = 0;
+      threshold = max(live, MinCollection);
+    }
+
+    /* Lambda lifting */
+
+    // Index of the supercombinator of `expr`, a lambda or an application
+    uint32_t compile(const Expression& expr){
+      uint32_t& tag = Expression::tag(expr.body);
+      if(tag && tag <= supercombinators.size()){
+        const Supercombinator& sc = supercombinators[tag - 1];
+        if(sc.type == expr.type && sc.body == expr.body && sc.arg == expr.arg)
+          return tag - 1;
+      }
+      Supercombinator sc;
+      sc.type = expr.type;
+      sc.body = expr.body;
+      sc.arg = expr.arg;
+      const Expression * body = &expr;
+      while(body->isLam()){
+        sc.names.push_back(body->name);
+        body = &Expression::at(body->body);
+      }
+      int lambdas = sc.names.size();
+
+      // The variables bound outside
+      vector<pair<const Expression *, int>> pending(1, make_pair(body, lambdas));
+      while(!pending.empty()){
+        const Expression * e = pending.back().first;
+        int depth = pending.back().second;
+        pending.pop_back();
+        if(e->isVar() && e->index >= depth){
+          sc.captured.push_back(e->index - depth);
+        }else if(e->isLam()){
+          pending.emplace_back(&Expression::at(e->body), depth + 1);
+        }else if(e->isAp()){
+          pending.emplace_back(&Expression::at(e->body), depth);
+          pending.emplace_back(&Expression::at(e->arg), depth);
+        }
+      }
+      sort(sc.captured.begin(), sc.captured.end());
+      sc.captured.erase(unique(sc.captured.begin(), sc.captured.end()), sc.captured.end());
+      sc.arity = sc.frame = sc.captured.size() + lambdas;
+
+      // The lambdas are the slots after the captured variables, the
+      // outermost first
+      vector<uint32_t> scope;
+      for(int i = 0; i < lambdas; ++i)
+        scope.push_back(sc.captured.size() + i);
+      sc.root = emit(sc, *body, scope);
+      sc.global = make(Kind::Global, supercombinators.size());
+      supercombinators.push_back(move(sc));
+      uint32_t index = supercombinators.size() - 1;
+      Expression::tag(expr.body) = index + 1;
+      return index;
+    }
+
+    uint32_t op(Supercombinator& sc, Op::Kind kind, uint32_t a, uint32_t b = 0, uint32_t c = 0){
+      sc.code.push_back(Op{kind, a, b, c});
+      return sc.code.size() - 1;
+    }
+
+    // The slot of the variable of de Bruijn index `index` under `scope`
+    uint32_t slot(const Supercombinator& sc, const vector<uint32_t>& scope, int index){
+      int depth = scope.size();
+      if(index < depth)
+        return scope[depth - 1 - index];
+      return lower_bound(sc.captured.begin(), sc.captured.end(), index - depth) - sc.captured.begin();
+    }
+
+    // Code building `expr`, its variables found in `scope` by level
+    uint32_t emit(Supercombinator& sc, const Expression& expr, vector<uint32_t>& scope){
+      switch(expr.type){
+        case Expression::Constant:
+          return op(sc, Op::Num, expr.val);
+        case Expression::Var:
+          if(expr.index < 0)
+            return op(sc, Op::Free, expr.name);
+          return op(sc, Op::Slot, slot(sc, scope, expr.index));
+        case Expression::Lambda:
+          {
+            // The closure: the lifted lambda applied to what it captures
+            uint32_t lifted = compile(expr);
+            uint32_t code = op(sc, Op::Node, supercombinators[lifted].global);
+            for(int index : supercombinators[lifted].captured)
+              code = op(sc, Op::App, code, op(sc, Op::Slot, slot(sc, scope, index)));
+            return code;
+          }
+        case Expression::Ap:
+          {
+            // The first argument first
+            vector<const Expression *> args;
+            const Expression * head = &expr;
+            for(; head->isAp(); head = &Expression::at(head->body))
+              args.push_back(&Expression::at(head->arg));
+            reverse(args.begin(), args.end());
+            vector<uint32_t> values;
+            for(const Expression * arg : args)
+              values.push_back(emit(sc, *arg, scope));
+            size_t lambdas = 0;
+            for(const Expression * e = head; e->isLam() && lambdas < args.size(); e = &Expression::at(e->body))
+              ++lambdas;
+            uint32_t code;
+            if(lambdas == 0){
+              code = emit(sc, *head, scope);
+            }else{
+              // A `let` for every lambda applied right away
+              size_t depth = scope.size();
+              const Expression * body = head;
+              for(size_t i = 0; i < lambdas; ++i){
+                scope.push_back(sc.frame++);
+                sc.names.push_back(body->name);
+                body = &Expression::at(body->body);
+              }
+              code = emit(sc, *body, scope);
+              for(size_t i = lambdas; i-- > 0; )
+                code = op(sc, Op::Let, scope[depth + i], values[i], code);
+              scope.resize(depth);
+            }
+            for(size_t i = lambdas; i < values.size(); ++i)
+              code = op(sc, Op::App, code, values[i]);
+            return code;
+          }
+        case Expression::Nothing:
+          break;
+      }
+      cerr << "[Graph] Unexpected expression type: " << (int)expr.type << endl;
+      exit(1);
+    }
+
+    /* Instantiation */
+
+    Id build(const Supercombinator& sc, uint32_t code){
+      while(true){
+        const Op& o = sc.code[code];
+        switch(o.kind){
+          case Op::Slot:
+            return locals[o.a];
+          case Op::Num:
+            return make(Kind::Num, o.a);
+          case Op::Free:
+            return make(Kind::Free, o.a);
+          case Op::Node:
+            return o.a;
+          case Op::Let:
+            locals[o.a] = build(sc, o.b);
+            code = o.c;
+            continue;
+          case Op::App:
+            {
+              // Down the spine without recursing
+              vector<uint32_t> args;
+              uint32_t head = code;
+              for(; sc.code[head].kind == Op::App; head = sc.code[head].a)
+                args.push_back(sc.code[head].b);
+              Id fun = build(sc, head);
+              for(size_t i = args.size(); i-- > 0; ){
+                Id arg = build(sc, args[i]);
+                fun = make(Kind::App, fun, arg);
+              }
+              return fun;
+            }
+        }
+      }
+    }
+
+    // Build the body of `sc` over the node `target`
+    void buildInto(const Supercombinator& sc, uint32_t code, Id target){
+      while(sc.code[code].kind == Op::Let){
+        const Op& o = sc.code[code];
+        locals[o.a] = build(sc, o.b);
+        code = o.c;
+      }
+      const Op& o = sc.code[code];
+      switch(o.kind){
+        case Op::Num:
+          nodes[target] = Node{Kind::Num, false, false, o.a, 0};
+          break;
+        case Op::Free:
+          nodes[target] = Node{Kind::Free, false, false, o.a, 0};
+          break;
+        case Op::App:
+          {
+            Id fun = build(sc, o.a);
+            Id arg = build(sc, o.b);
+            if(deref(fun) == target){
+              cerr << "[Graph] <<loop>>" << endl;
+              exit(1);
+            }
+            nodes[target] = Node{Kind::App, false, false, fun, arg};
+          }
+          break;
+        default:
+          redirect(target, build(sc, code));
+          break;
+      }
+    }
+
+    /* Primitives */
+
+    Id primitive(const Native& native){
+      auto it = natives.find(&native);
+      if(it != natives.end())
+        return it->second;
+      Id node;
+      if(strcmp(native.name, "Y") == 0){
+        node = fix();
+      }else{
+        const Term * term = find_if(begin(terms), end(terms), [&native](const Term& t){
+          return strcmp(t.name, native.name) == 0;
+        });
+        if(term != end(terms)){
+          node = closed(term->source);
+          if(strcmp(native.name, "putStr") == 0){
+            node = make(Kind::App, node, fix());
+            node = make(Kind::App, node, primitive(*prelude.lookup("putChar").native()));
+          }
+        }else{
+          primitives.push_back(Primitive{&native, native.arity, false, strcmp(native.name, "*") == 0});
+          node = make(Kind::Prim, primitives.size() - 1);
+        }
+      }
+      globals.push_back(node);
+      return natives[&native] = node;
+    }
+
+    // The graph of the closed lambda term `source`
+    Id closed(const char * source){
+      Scanner scanner(source);
+      Expression& expr = Expression::at(parseExpression(scanner));
+      Context().resolve(expr);
+      return import(Object(expr));
+    }
+
+    Id fix(){
+      if(!hasFix){
+        primitives.push_back(Primitive{nullptr, 1, true, false});
+        fixNode = make(Kind::Prim, primitives.size() - 1);
+        globals.push_back(fixNode);
+        hasFix = true;
+      }
+      return fixNode;
+    }
+
+    Object exported(Id n) const {
+      const Node& node = nodes[n];
+      if(node.kind == Kind::Num)
+        return makeNormalForm(Expression((int)node.a));
+      Expression var(Expression::Var);
+      var.name = node.a;
+      return makeNormalForm(var);
+    }
+
+    /* Import of the objects of the runtime */
+
+    // The graph of `obj`, the frames it refers to imported once each
+    Id import(const Object& obj){
+      unordered_map<const Object *, Id> seen;
+      vector<pair<const Object *, Id>> pending;
+      auto frame = [this, &seen, &pending](const Context& env, int index){
+        const Object * value = &env[index];
+        auto it = seen.find(value);
+        if(it != seen.end()) return it->second;
+        Id hole = make(Kind::Hole, 0);
+        pending.emplace_back(value, hole);
+        return seen[value] = hole;
+      };
+      Id root = make(Kind::Hole, 0);
+      pending.emplace_back(&obj, root);
+      while(!pending.empty()){
+        const Object& value = *pending.back().first;
+        Id into = pending.back().second;
+        pending.pop_back();
+        const Expression& expr = value.expr();
+        Id node;
+        if(value.isPrimitive()){
+          // Applied to the arguments it holds, the first one deepest
+          node = primitive(*value.native());
+          int held = value.native()->arity - value.missing();
+          for(int i = held - 1; i >= 0; --i)
+            node = make(Kind::App, node, frame(value.env(), i));
+        }else if(value.isBlackhole()){
+          cerr << "[Graph] Context under evaluation" << endl;
+          exit(1);
+        }else if(expr.isNum()){
+          node = make(Kind::Num, expr.val);
+        }else if(expr.isVar() && expr.index < 0){
+          node = make(Kind::Free, expr.name);
+        }else if(value.isNormalForm()){
+          cerr << "[Graph] Unsupported normal form in the context" << endl;
+          exit(1);
+        }else if(expr.isVar()){
+          node = frame(value.env(), expr.index);
+        }else{
+          uint32_t index = compile(expr);
+          const Supercombinator& sc = supercombinators[index];
+          node = sc.global;
+          for(int index : sc.captured)
+            node = make(Kind::App, node, frame(value.env(), index));
+        }
+        nodes[into] = Node{Kind::Ind, false, false, node, 0};
+      }
+      return root;
+    }
+
+    /* Evaluation */
+
+    // Reduce `root` to weak head normal form, return the node it became
+    Id whnf(Id root){
+      size_t floor = dump.size();
+      size_t base = stack.size();
+      stack.push_back(root);
+      while(true){
+        if(allocated >= threshold)
+          collect();
+        Id top = stack.back();
+        const Node node = nodes[top];
+        size_t args = stack.size() - 1 - base;
+        switch(node.kind){
+          case Kind::Ind:
+            stack.back() = deref(top);
+            continue;
+          case Kind::App:
+            stack.push_back(node.a);
+            continue;
+          case Kind::Global:
+            {
+              const Supercombinator& sc = supercombinators[node.a];
+              if(args < (size_t)sc.arity) break;
+              size_t last = stack.size() - 1;
+              Id redex = stack[last - sc.arity];
+              locals.resize(sc.frame);
+              for(int i = 0; i < sc.arity; ++i)
+                locals[i] = nodes[stack[last - 1 - i]].b;
+              Governor::step();
+              STATS(Stats::beta(nullptr));
+              buildInto(sc, sc.root, redex);
+              stack.resize(last - sc.arity + 1);
+              continue;
+            }
+          case Kind::Prim:
+            {
+              // A copy, the import of the result may add primitives
+              const Primitive prim = primitives[node.a];
+              if(args < (size_t)prim.arity) break;
+              size_t last = stack.size() - 1;
+              Id redex = stack[last - prim.arity];
+              if(prim.fix){
+                // Y f = f (Y f), the application itself being `Y f`
+                Governor::step();
+                nodes[redex] = Node{Kind::App, false, false, nodes[stack[last - 1]].b, redex};
+                stack.resize(last);
+                continue;
+              }
+              // The operands are numbers, or free variables such as the world
+              vector<Id> operands(prim.arity);
+              bool ready = true;
+              for(int i = 0; i < prim.arity && ready; ++i){
+                Id arg = deref(nodes[stack[last - 1 - i]].b);
+                operands[i] = arg;
+                Kind kind = nodes[arg].kind;
+                if(kind == Kind::Num || kind == Kind::Free) continue;
+                if(i == 1 && prim.lazySecond && nodes[operands[0]].kind == Kind::Num && nodes[operands[0]].a == 0) continue;
+                if(nodes[arg].busy){
+                  cerr << "[Graph] <<loop>>" << endl;
+                  exit(1);
+                }
+                nodes[arg].busy = true;
+                dump.push_back(Frame{base, arg});
+                base = stack.size();
+                stack.push_back(arg);
+                ready = false;
+              }
+              if(!ready) continue;
+              // The last one first, as natives take them
+              vector<Object> values;
+              for(int i = prim.arity - 1; i >= 0; --i){
+                Kind kind = nodes[operands[i]].kind;
+                values.push_back(kind == Kind::Num || kind == Kind::Free ? exported(operands[i]) : makeNormalForm(Expression(0)));
+              }
+              Object res = prim.native->code(values.data());
+              Governor::step();
+              STATS(Stats::primitive(*prim.native));
+              redirect(redex, import(res));
+              stack.resize(last - prim.arity + 1);
+              continue;
+            }
+          case Kind::Num:
+          case Kind::Free:
+            break;
+          case Kind::Hole:
+          case Kind::Dead:
+            cerr << "[Graph] Unexpected node: " << (int)node.kind << endl;
+            exit(1);
+        }
+        // Weak head normal form
+        Id value = deref(stack[base]);
+        stack.resize(base);
+        if(dump.size() == floor)
+          return value;
+        Kind kind = nodes[value].kind;
+        if(kind != Kind::Num && kind != Kind::Free){
+          cerr << "[Graph] A primitive needs a number" << endl;
+          exit(1);
+        }
+        nodes[dump.back().node].busy = false;
+        base = dump.back().base;
+        dump.pop_back();
+      }
+    }
+
+    // Everything the program at `root` starts from
+    Image save(Id root){
+      Image image;
+      image.root = root;
+      image.yes = deref(closed("\\a \\b a"));
+      image.no = deref(closed("\\a \\b b"));
+      image.result = deref(closed("\\a \\s \\p p a s"));
+      image.nil = deref(closed("\\s \\z z"));
+      image.cons = deref(closed("\\x \\xs \\s \\z s x xs"));
+      image.nodes = nodes;
+      image.supercombinators = supercombinators;
+      image.primitives = primitives;
+      image.globals = globals;
+      return image;
+    }
+
+    /* Readback */
+
+    // Normal form of the graph at `root`, read with a stack of tasks rather
+    // than by recursion, as lists run deep
+    Object readback(Id root){
+      struct Task{
+        enum Kind{
+          // Read the node back
+          Read,
+          // Wrap the last result in a lambda binding `name`
+          Lambda,
+          // Apply the result under the last `count` ones to them
+          Apply
+        } kind;
+        Id node;
+        uint32_t name;
+        size_t count;
+        // The pins to keep once done
+        size_t held;
+      };
+      vector<Task> tasks(1, Task{Task::Read, root, 0, 0, 0});
+      vector<Object> results;
+      while(!tasks.empty()){
+        const Task task = tasks.back();
+        tasks.pop_back();
+        if(task.kind == Task::Lambda){
+          Expression lam(Expression::Lambda);
+          lam.name = task.name;
+          lam.body = Expression::make(results.back().expr());
+          results.back() = makeNormalForm(lam);
+          pinned.resize(task.held);
+          continue;
+        }
+        if(task.kind == Task::Apply){
+          size_t first = results.size() - task.count;
+          Object nf = results[first - 1];
+          for(size_t i = first; i < results.size(); ++i){
+            Expression ap(Expression::Ap);
+            ap.body = Expression::make(nf.expr());
+            ap.arg = Expression::make(results[i].expr());
+            nf = makeNormalForm(ap);
+          }
+          results.erase(results.begin() + first, results.end());
+          results.back() = nf;
+          pinned.resize(task.held);
+          continue;
+        }
+        size_t held = pinned.size();
+        pinned.push_back(task.node);
+        Id value = whnf(task.node);
+        Id head = value;
+        vector<Id> args;
+        while(nodes[head].kind == Kind::App){
+          args.push_back(nodes[head].b);
+          head = deref(nodes[head].a);
+        }
+        pinned.insert(pinned.end(), args.begin(), args.end());
+        const Node node = nodes[head];
+        if(node.kind == Kind::Global && args.size() < (size_t)supercombinators[node.a].arity){
+          // A lambda, its variable stays a free, named variable
+          const Supercombinator& sc = supercombinators[node.a];
+          Symbol name = sc.names[args.size() - sc.captured.size()];
+          Id var = make(Kind::Free, name);
+          pinned.push_back(var);
+          tasks.push_back(Task{Task::Lambda, 0, name, 0, held});
+          tasks.push_back(Task{Task::Read, make(Kind::App, value, var), 0, 0, 0});
+          continue;
+        }
+        Expression expr;
+        if(node.kind == Kind::Num){
+          expr = Expression((int)node.a);
+        }else if(node.kind == Kind::Free){
+          expr = Expression(Expression::Var);
+          expr.name = node.a;
+        }else if(node.kind == Kind::Prim){
+          const Primitive& prim = primitives[node.a];
+          expr = Expression(prim.fix ? "Y" : prim.native->name);
+        }else{
+          cerr << "[Graph] Unexpected node: " << (int)node.kind << endl;
+          exit(1);
+        }
+        results.push_back(makeNormalForm(expr));
+        // The arguments are read first to last, `args` holds them the
+        // other way round
+        tasks.push_back(Task{Task::Apply, 0, 0, args.size(), held});
+        for(Id arg : args)
+          tasks.push_back(Task{Task::Read, arg, 0, 0, 0});
+      }
+      return results.back();
+    }
+};
+
+}
+
+Object Graph::normalForm(const Expression& expr, const Context& env){
+  // What the natives call back with their arguments
+  if(expr.isNum() || (expr.isVar() && expr.index < 0))
+    return makeNormalForm(expr);
+  Reducer reducer;
+  reducer.prelude = env;
+  return reducer.readback(reducer.import(Object(expr, env)));
+}
+
+Image Graph::image(const Expression& expr, const Context& env){
+  Reducer reducer;
+  reducer.prelude = env;
+  return reducer.save(reducer.import(Object(expr, env)));
+}
@@ -0,0 +1,118 @@
+#ifndef __ULC_GRAPH_HPP__
+#define __ULC_GRAPH_HPP__
+
+#include <cstdint>
+#include <vector>
+
+#include "Runtime.hpp"
+
+// Graph reduction of supercombinators, without environments.
+// Every lambda is lifted into a supercombinator taking the variables it
+// captures as its first arguments, a `let` becomes a node shared by the
+// uses of its variable. A supercombinator applied to all of its arguments
+// is instantiated in place of the application, so that every use of it
+// sees the result. `Y` ties a cycle in the graph.
+//
+// The arithmetic, comparison and IO primitives are the natives of the
+// prelude, called once their arguments are numbers and the world; what
+// they return is turned back into a graph. The list primitives and
+// `putStr` are the lambda terms they stand for, and `par` does not spark.
+namespace Graph{
+
+// A node is its index in the heap
+using Id = uint32_t;
+
+enum class Kind : uint8_t{
+  App,
+  Num,
+  // A free variable, or the world
+  Free,
+  // The supercombinator `a`
+  Global,
+  // The primitive `a`
+  Prim,
+  // Updated to the node `a`
+  Ind,
+  // Being filled by an import
+  Hole,
+  // Free for allocation
+  Dead
+};
+
+struct Node{
+  Kind kind;
+  bool marked;
+  // Under evaluation for a primitive
+  bool busy;
+  // App: the function and the argument; Num: the value; Free: the name
+  uint32_t a, b;
+};
+
+// Instructions building the body of a supercombinator
+struct Op{
+  enum Kind : uint8_t{
+    // The argument or the `let` in slot `a`
+    Slot,
+    Num,
+    Free,
+    // The node `a`
+    Node,
+    // The result of `a` applied to the result of `b`
+    App,
+    // Bind the result of `b` to slot `a`, then `c`
+    Let
+  } kind;
+  uint32_t a, b, c;
+};
+
+struct Supercombinator{
+  // What it was compiled from, found again through the tag of `body`
+  Expression::Type type;
+  Expression::Ref body, arg;
+  // Indices, outside of the lambdas, of the variables it captures; they
+  // come first among its arguments
+  std::vector<int> captured;
+  // Names of the lambdas, then of the `let`s
+  std::vector<Symbol> names;
+  int arity;
+  // Slots: the arguments, then the `let`s
+  int frame;
+  std::vector<Op> code;
+  uint32_t root;
+  Id global;
+};
+
+struct Primitive{
+  // Null for `Y`
+  const Native * native;
+  int arity;
+  // `Y`: the application is updated to the function applied to itself
+  bool fix;
+  // `*`: the second operand is not evaluated after a 0
+  bool lazySecond;
+};
+
+// The graph of a program before its evaluation, and the supercombinators
+// it needs
+struct Image{
+  std::vector<Node> nodes;
+  std::vector<Supercombinator> supercombinators;
+  std::vector<Primitive> primitives;
+  // Nodes that outlive the program: primitives and the terms standing
+  // for them
+  std::vector<Id> globals;
+  Id root;
+  // Supercombinators of what the natives return: the booleans, `pair a s`
+  // taking `a` and `s`, [] and :
+  Id yes, no, result, nil, cons;
+};
+
+// Normal form of `expr` in `env`
+Object normalForm(const Expression& expr, const Context& env);
+
+// The image of `expr` in `env`
+Image image(const Expression& expr, const Context& env);
+
+}
+
+#endif
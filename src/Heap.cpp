@@ -0,0 +1,152 @@
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <new>
+
+#include "Heap.hpp"
+
+using namespace std;
+
+namespace{
+
+const size_t ChunkSize = 1 << 16;
+const size_t Granule = 16;
+const size_t Classes = 16;
+
+struct FreeBlock{
+  FreeBlock * next;
+};
+
+struct Arena{
+  FreeBlock * freeLists[Classes];
+  char * bump;
+  char * limit;
+  vector<char *> chunks;
+  Heap::Stats stats;
+
+  Arena() : freeLists(), bump(nullptr), limit(nullptr), stats() {}
+
+  void * refill(size_t size){
+    char * chunk = static_cast<char *>(malloc(ChunkSize));
+    if(chunk == nullptr){
+      cerr << "[Heap] Out of memory" << endl;
+      exit(1);
+    }
+    chunks.push_back(chunk);
+    stats.bytesReserved += ChunkSize;
+    bump = chunk + size;
+    limit = chunk + ChunkSize;
+    return chunk;
+  }
+};
+
+// Arenas are never destroyed, blocks may be freed into another thread's
+// arena and stay in use after their maker is gone.
+const unsigned MaxArenas = 256;
+Arena * arenas[MaxArenas];
+unsigned arenaCount = 0;
+
+Arena& arena(){
+  static thread_local Arena * local = nullptr;
+  if(!local){
+    local = new Arena();
+    static SpinLock registering;
+    registering.lock();
+    if(arenaCount == MaxArenas){
+      cerr << "[Heap] Too many threads" << endl;
+      exit(1);
+    }
+    arenas[arenaCount] = local;
+    __atomic_store_n(&arenaCount, arenaCount + 1, __ATOMIC_RELEASE);
+    registering.unlock();
+  }
+  return *local;
+}
+
+size_t sizeClass(size_t size){
+  return (size + Granule - 1) / Granule - 1;
+}
+
+}
+
+bool Heap::concurrent = false;
+
+void * Heap::allocate(size_t size){
+  Arena& a = arena();
+  a.stats.allocations += 1;
+  a.stats.bytesAllocated += size;
+  a.stats.bytesLive += size;
+  if(a.stats.bytesLive > a.stats.bytesPeak)
+    a.stats.bytesPeak = a.stats.bytesLive;
+
+  size_t cls = sizeClass(size);
+  if(cls >= Classes)
+    return ::operator new(size);
+  if(FreeBlock * block = a.freeLists[cls]){
+    a.freeLists[cls] = block->next;
+    return block;
+  }
+  size_t rounded = (cls + 1) * Granule;
+  if(a.bump + rounded > a.limit)
+    return a.refill(rounded);
+  void * res = a.bump;
+  a.bump += rounded;
+  return res;
+}
+
+void Heap::deallocate(void * ptr, size_t size){
+  Arena& a = arena();
+  a.stats.frees += 1;
+  a.stats.bytesLive -= size;
+
+  size_t cls = sizeClass(size);
+  if(cls >= Classes){
+    ::operator delete(ptr);
+    return ;
+  }
+  FreeBlock * block = static_cast<FreeBlock *>(ptr);
+  block->next = a.freeLists[cls];
+  a.freeLists[cls] = block;
+}
+
+void Heap::account(size_t allocations, size_t frees, size_t size){
+  Arena& a = arena();
+  a.stats.allocations += allocations;
+  a.stats.bytesAllocated += allocations * size;
+  a.stats.bytesLive += allocations * size;
+  if(a.stats.bytesLive > a.stats.bytesPeak)
+    a.stats.bytesPeak = a.stats.bytesLive;
+  a.stats.frees += frees;
+  a.stats.bytesLive -= frees * size;
+}
+
+const Heap::Stats& Heap::stats(){
+  if(!concurrent)
+    return arena().stats;
+  // The other threads may be updating theirs, the sum is approximate.
+  // A block freed by another thread than its maker counts as live in one
+  // arena and freed in the other, only the sum is meaningful.
+  static thread_local Stats sum;
+  sum = Stats();
+  unsigned n = __atomic_load_n(&arenaCount, __ATOMIC_ACQUIRE);
+  for(unsigned i = 0; i < n; ++i){
+    const Stats& s = arenas[i]->stats;
+    sum.allocations += __atomic_load_n(&s.allocations, __ATOMIC_RELAXED);
+    sum.frees += __atomic_load_n(&s.frees, __ATOMIC_RELAXED);
+    sum.bytesAllocated += __atomic_load_n(&s.bytesAllocated, __ATOMIC_RELAXED);
+    sum.bytesLive += __atomic_load_n(&s.bytesLive, __ATOMIC_RELAXED);
+    sum.bytesPeak += __atomic_load_n(&s.bytesPeak, __ATOMIC_RELAXED);
+    sum.bytesReserved += __atomic_load_n(&s.bytesReserved, __ATOMIC_RELAXED);
+  }
+  return sum;
+}
+
+void Heap::printStats(ostream& out, const Stats& since){
+  const Stats& s = stats();
+  out << "[Heap] allocations: " << s.allocations - since.allocations
+      << ", frees: " << s.frees - since.frees
+      << ", bytes allocated: " << s.bytesAllocated - since.bytesAllocated
+      << ", live: " << s.bytesLive
+      << ", peak: " << s.bytesPeak
+      << ", reserved: " << s.bytesReserved << endl;
+}
@@ -0,0 +1,201 @@
+#ifndef __ULC_HEAP_HPP__
+#define __ULC_HEAP_HPP__
+
+#include <cstddef>
+#include <cstdlib>
+#include <utility>
+#include <new>
+#include <vector>
+#include <atomic>
+#include <iostream>
+
+// Runtime heap of the evaluator.
+// Small blocks are carved out of large chunks by bumping a pointer and are
+// recycled through free lists segregated by size class, bigger blocks go
+// to the system allocator.
+class Heap{
+  public:
+    struct Stats{
+      size_t allocations;
+      size_t frees;
+      size_t bytesAllocated;
+      size_t bytesLive;
+      size_t bytesPeak;
+      size_t bytesReserved;
+    };
+
+    // Set before a second thread starts evaluating. From then on every
+    // thread allocates from its own arena, reference counts are atomic and
+    // the shared structures take their locks.
+    static bool concurrent;
+
+    static void * allocate(size_t);
+    static void deallocate(void *, size_t);
+
+    // Count blocks of `size` bytes allocated and freed outside the heap, in
+    // a store of an engine's own
+    static void account(size_t allocations, size_t frees, size_t size);
+
+    // Summed over the arenas of every thread
+    static const Stats& stats();
+    // Report the allocations made since `since` was taken
+    static void printStats(std::ostream&, const Stats& since);
+
+    // Construct a `T` on the heap
+    template<class T, class... Args>
+    static T * make(Args&&... args){
+      return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Destroying a `T` may release more of them, those are destroyed by
+    // the outermost call so long chains do not recurse on the C++ stack.
+    // Each thread has its own queue, kept behind a plain pointer so that
+    // reaching it costs no initialisation check.
+    template<class T>
+    static void destroy(T * t){
+      static thread_local std::vector<T *> * pending = nullptr;
+      static thread_local bool destroying = false;
+      if(!pending) pending = new std::vector<T *>();
+      pending->push_back(t);
+      if(destroying) return ;
+      destroying = true;
+      while(!pending->empty()){
+        T * p = pending->back();
+        pending->pop_back();
+        p->~T();
+        deallocate(p, sizeof(T));
+      }
+      destroying = false;
+    }
+};
+
+// Busy-waiting lock, it only locks while `Heap::concurrent` is set
+class SpinLock{
+    std::atomic_flag flag;
+  public:
+    SpinLock() { flag.clear();}
+
+    void lock(){
+      if(Heap::concurrent)
+        while(flag.test_and_set(std::memory_order_acquire));
+    }
+    void unlock(){
+      if(Heap::concurrent)
+        flag.clear(std::memory_order_release);
+    }
+};
+
+// Base of everything owned through a `Ref`
+class Cell{
+  public:
+    unsigned refs;
+
+    Cell() : refs(0) {}
+    Cell(const Cell&) : refs(0) {}
+    Cell& operator = (const Cell&) { return *this;}
+
+    void retain(){
+      if(Heap::concurrent) __atomic_add_fetch(&refs, 1, __ATOMIC_RELAXED);
+      else ++refs;
+    }
+    // The references left
+    unsigned drop(){
+      if(Heap::concurrent) return __atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL);
+      return --refs;
+    }
+};
+
+// Intrusive reference to a `Cell` living on the `Heap`, the count is only
+// atomic while several threads run
+template<class T>
+class Ref{
+    T * _ptr;
+
+    void release(){
+      if(_ptr && _ptr->drop() == 0)
+        Heap::destroy(_ptr);
+    }
+  public:
+    Ref() : _ptr(nullptr) {}
+    explicit Ref(T * t) : _ptr(t) { if(_ptr) _ptr->retain();}
+    Ref(const Ref& ref) : _ptr(ref._ptr) { if(_ptr) _ptr->retain();}
+    Ref(Ref&& ref) : _ptr(ref._ptr) { ref._ptr = nullptr;}
+    ~Ref() { release();}
+
+    Ref& operator = (Ref ref){
+      std::swap(_ptr, ref._ptr);
+      return *this;
+    }
+
+    T * get() const { return _ptr;}
+    T& operator * () const { return *_ptr;}
+    T * operator -> () const { return _ptr;}
+    explicit operator bool () const { return _ptr != nullptr;}
+
+    template<class... Args>
+    static Ref make(Args&&... args){
+      return Ref(Heap::make<T>(std::forward<Args>(args)...));
+    }
+};
+
+// Intrusive list of the `T`s made by one thread, linked through their
+// `list`, `prevLive` and `nextLive` members. A `T` may die on another
+// thread than its maker, so each list has its own lock.
+template<class T>
+class LiveList{
+    SpinLock lock;
+  public:
+    static const unsigned MaxThreads = 256;
+
+    T * head;
+
+    LiveList() : head(nullptr) {}
+
+    void link(T * t){
+      lock.lock();
+      t->list = this;
+      t->prevLive = nullptr;
+      t->nextLive = head;
+      if(head) head->prevLive = t;
+      head = t;
+      lock.unlock();
+    }
+
+    void unlink(T * t){
+      lock.lock();
+      if(t->prevLive) t->prevLive->nextLive = t->nextLive;
+      else head = t->nextLive;
+      if(t->nextLive) t->nextLive->prevLive = t->prevLive;
+      t->list = nullptr;
+      lock.unlock();
+    }
+
+    // The list of the calling thread
+    static LiveList& local(){
+      static thread_local LiveList * list = nullptr;
+      if(!list){
+        list = new LiveList();
+        static SpinLock registering;
+        registering.lock();
+        if(count == MaxThreads){
+          std::cerr << "[Heap] Too many threads" << std::endl;
+          exit(1);
+        }
+        lists[count] = list;
+        __atomic_store_n(&count, count + 1, __ATOMIC_RELEASE);
+        registering.unlock();
+      }
+      return *list;
+    }
+
+    // Every thread's list, walked while the other threads are stopped
+    static LiveList * lists[MaxThreads];
+    static unsigned count;
+};
+
+template<class T>
+LiveList<T> * LiveList<T>::lists[LiveList<T>::MaxThreads];
+template<class T>
+unsigned LiveList<T>::count = 0;
+
+#endif
@@ -0,0 +1,102 @@
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "IO.hpp"
+#include "Heap.hpp"
+
+using namespace std;
+
+namespace{
+
+const size_t OutputSize = 64 << 10;
+
+char output[OutputSize];
+size_t outputUsed = 0;
+
+char * input = nullptr;
+size_t inputBlock = 64 << 10;
+size_t inputBegin = 0, inputEnd = 0;
+bool inputClosed = false;
+
+// Sparks may run IO actions too
+SpinLock ioLock;
+
+void writeOut(){
+  size_t done = 0;
+  while(done < outputUsed){
+    ssize_t n = write(STDOUT_FILENO, output + done, outputUsed - done);
+    if(n < 0 && errno == EINTR) continue;
+    if(n < 0){
+      cerr << "[IO] Cannot write the output" << endl;
+      // Give up on the buffer, exiting flushes it again
+      outputUsed = 0;
+      exit(1);
+    }
+    done += n;
+  }
+  outputUsed = 0;
+}
+
+bool readIn(){
+  if(inputClosed) return false;
+  if(!input){
+    input = static_cast<char *>(malloc(inputBlock));
+    if(input == nullptr){
+      cerr << "[IO] Out of memory" << endl;
+      exit(1);
+    }
+  }
+  while(true){
+    ssize_t n = read(STDIN_FILENO, input, inputBlock);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0){
+      inputClosed = true;
+      return false;
+    }
+    inputBegin = 0;
+    inputEnd = n;
+    return true;
+  }
+}
+
+// Also reached from an exit while the lock is held
+void flushAtExit(){
+  writeOut();
+}
+
+const bool registered = (atexit(flushAtExit), true);
+
+}
+
+void IO::put(int c){
+  lock_guard<SpinLock> guard(ioLock);
+  if(outputUsed == OutputSize)
+    writeOut();
+  output[outputUsed++] = c;
+}
+
+void IO::flush(){
+  lock_guard<SpinLock> guard(ioLock);
+  writeOut();
+}
+
+int IO::get(){
+  lock_guard<SpinLock> guard(ioLock);
+  if(inputBegin == inputEnd){
+    writeOut();
+    if(!readIn())
+      return -1;
+  }
+  return static_cast<unsigned char>(input[inputBegin++]);
+}
+
+void IO::setInputBlock(size_t bytes){
+  if(bytes == 0) bytes = 1;
+  free(input);
+  input = nullptr;
+  inputBlock = bytes;
+}
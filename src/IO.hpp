@@ -0,0 +1,23 @@
+#ifndef __ULC_IO_HPP__
+#define __ULC_IO_HPP__
+
+#include <cstddef>
+
+// Buffered standard input and output of the programs.
+//
+// Output collects in a large buffer, written out once it is full, before
+// reading input (so prompts show), on `flush` and at exit. Input is read
+// in blocks of `setInputBlock` bytes.
+namespace IO{
+
+void put(int c);
+void flush();
+
+// The next byte of the input, -1 at its end
+int get();
+// 1 reads the input a byte at a time
+void setInputBlock(size_t bytes);
+
+}
+
+#endif
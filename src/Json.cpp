@@ -0,0 +1,327 @@
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "Json.hpp"
+
+using namespace std;
+
+namespace{
+
+const size_t BlockSize = 64 << 10;
+
+class Input{
+    int fd;
+    vector<char> block;
+    size_t begin, end;
+    bool closed;
+
+    bool fill(){
+      if(closed) return false;
+      while(true){
+        ssize_t n = ::read(fd, block.data(), block.size());
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0){
+          closed = true;
+          return false;
+        }
+        begin = 0;
+        end = n;
+        return true;
+      }
+    }
+
+  public:
+    explicit Input(int f) : fd(f), block(BlockSize), begin(0), end(0), closed(false) {}
+
+    // The next byte, -1 at the end of the input
+    int peek(){
+      if(begin == end && !fill()) return -1;
+      return static_cast<unsigned char>(block[begin]);
+    }
+
+    int get(){
+      int c = peek();
+      if(c >= 0) ++begin;
+      return c;
+    }
+
+    int next(){
+      while(true){
+        int c = peek();
+        if(c != ' ' && c != '\t' && c != '\n' && c != '\r') return c;
+        ++begin;
+      }
+    }
+
+    void expect(char c){
+      if(next() != c) fail(string("Expected a `") + c + "`");
+      ++begin;
+    }
+
+    string text(){
+      expect('"');
+      string str;
+      while(true){
+        // Copy up to the next quote or escape in one go
+        const char * first = block.data() + begin, * last = block.data() + end;
+        const char * stop = first;
+        while(stop != last && *stop != '"' && *stop != '\\') ++stop;
+        str.append(first, stop);
+        begin += stop - first;
+        int c = get();
+        if(c == '"') return str;
+        if(c == '\\'){
+          escape(str);
+        }else if(c < 0){
+          fail("Unterminated string");
+        }else{
+          str += static_cast<char>(c);
+        }
+      }
+    }
+
+    int integer(){
+      bool negative = next() == '-';
+      if(negative) get();
+      if(peek() < '0' || peek() > '9') fail("Expected an integer");
+      // INT_MIN has no positive counterpart
+      const unsigned long long limit = negative ? 1ull + INT_MAX : INT_MAX;
+      unsigned long long value = 0;
+      while(peek() >= '0' && peek() <= '9'){
+        value = value * 10 + (peek() - '0');
+        if(value > limit) fail("Integer out of range");
+        get();
+      }
+      return negative ? -(long long)value : value;
+    }
+
+    [[noreturn]] void fail(const string& what){
+      int c = peek();
+      cerr << "[Json] " << what << ", found "
+           << (c < 0 ? string("the end of the input") : "`" + string(1, c) + "`") << endl;
+      exit(1);
+    }
+
+  private:
+    unsigned hex4(){
+      unsigned code = 0;
+      for(int i = 0; i < 4; ++i){
+        int c = get();
+        code <<= 4;
+        if(c >= '0' && c <= '9') code |= c - '0';
+        else if(c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+        else fail("Bad \\u escape");
+      }
+      return code;
+    }
+
+    void escape(string& str){
+      int c = get();
+      switch(c){
+        case '"': case '\\': case '/': str += static_cast<char>(c); return ;
+        case 'b': str += '\b'; return ;
+        case 'f': str += '\f'; return ;
+        case 'n': str += '\n'; return ;
+        case 'r': str += '\r'; return ;
+        case 't': str += '\t'; return ;
+        case 'u': break;
+        default: fail("Bad escape");
+      }
+      unsigned code = hex4();
+      if(code >= 0xD800 && code < 0xDC00 && peek() == '\\'){
+        get();
+        if(get() != 'u') fail("Bad surrogate pair");
+        unsigned low = hex4();
+        if(low < 0xDC00 || low >= 0xE000) fail("Bad surrogate pair");
+        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+      }
+      // UTF-8
+      if(code < 0x80){
+        str += static_cast<char>(code);
+      }else if(code < 0x800){
+        str += static_cast<char>(0xC0 | code >> 6);
+        str += static_cast<char>(0x80 | (code & 0x3F));
+      }else if(code < 0x10000){
+        str += static_cast<char>(0xE0 | code >> 12);
+        str += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        str += static_cast<char>(0x80 | (code & 0x3F));
+      }else{
+        str += static_cast<char>(0xF0 | code >> 18);
+        str += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+        str += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        str += static_cast<char>(0x80 | (code & 0x3F));
+      }
+    }
+};
+
+class Output{
+    ostream& out;
+    vector<char> block;
+    size_t used;
+  public:
+    explicit Output(ostream& o) : out(o), block(BlockSize), used(0) {}
+    ~Output() { flush();}
+
+    void flush(){
+      out.write(block.data(), used);
+      used = 0;
+    }
+
+    void put(const char * str, size_t length){
+      if(used + length > block.size()){
+        flush();
+        if(length > block.size()){
+          out.write(str, length);
+          return ;
+        }
+      }
+      memcpy(block.data() + used, str, length);
+      used += length;
+    }
+
+    void put(const char * str){ put(str, strlen(str));}
+
+    void integer(int value){
+      char digits[16];
+      char * p = digits + sizeof(digits);
+      unsigned magnitude = value < 0 ? 0u - value : value;
+      do{
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+      }while(magnitude);
+      if(value < 0) *--p = '-';
+      put(p, digits + sizeof(digits) - p);
+    }
+
+    void text(const string& str){
+      put("\"", 1);
+      size_t done = 0;
+      for(size_t i = 0; i < str.size(); ++i){
+        unsigned char c = str[i];
+        if(c != '"' && c != '\\' && c >= 0x20) continue;
+        put(str.data() + done, i - done);
+        done = i + 1;
+        if(c == '"' || c == '\\'){
+          char escaped[2] = {'\\', static_cast<char>(c)};
+          put(escaped, 2);
+        }else{
+          char escaped[7];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          put(escaped, 6);
+        }
+      }
+      put(str.data() + done, str.size() - done);
+      put("\"", 1);
+    }
+};
+
+}
+
+Expression::Ref Json::read(int fd){
+  Input in(fd);
+  // Lambdas and applications still missing some of their children
+  vector<Expression> open;
+  while(true){
+    Expression::Ref value;
+    in.expect('[');
+    string tag = in.text();
+    in.expect(',');
+    if(tag == "int"){
+      Expression expr(in.integer());
+      in.expect(']');
+      value = Expression::make(expr);
+    }else if(tag == "var"){
+      Expression expr(in.text());
+      in.expect(']');
+      value = Expression::make(expr);
+    }else if(tag == "lam"){
+      Expression expr(Expression::Lambda);
+      expr.name = intern(in.text());
+      in.expect(',');
+      open.push_back(expr);
+      continue;
+    }else if(tag == "app"){
+      open.push_back(Expression(Expression::Ap));
+      continue;
+    }else{
+      cerr << "[Json] Unexpected tag: " << tag << endl;
+      exit(1);
+    }
+    // Hand the value to the arrays it completes
+    while(true){
+      if(open.empty()){
+        if(in.next() >= 0) in.fail("Expected the end of the input");
+        return value;
+      }
+      Expression& parent = open.back();
+      if(parent.isAp() && parent.body == Expression::null){
+        parent.body = value;
+        in.expect(',');
+        break;
+      }
+      (parent.isAp() ? parent.arg : parent.body) = value;
+      in.expect(']');
+      value = Expression::make(parent);
+      open.pop_back();
+    }
+  }
+}
+
+void Json::write(const Expression& root, ostream& out){
+  Output output(out);
+  // Expressions being written, with how many of their children are done
+  vector<pair<const Expression *, int>> stack(1, make_pair(&root, 0));
+  while(!stack.empty()){
+    const Expression& expr = *stack.back().first;
+    int done = stack.back().second++;
+    switch(expr.type){
+      case Expression::Constant:
+        output.put("[\"int\",");
+        output.integer(expr.val);
+        output.put("]");
+        stack.pop_back();
+        break;
+      case Expression::Var:
+        output.put("[\"var\",");
+        output.text(symbolName(expr.name));
+        output.put("]");
+        stack.pop_back();
+        break;
+      case Expression::Lambda:
+        if(done == 0){
+          output.put("[\"lam\",");
+          output.text(symbolName(expr.name));
+          output.put(",");
+          stack.push_back(make_pair(&Expression::at(expr.body), 0));
+        }else{
+          output.put("]");
+          stack.pop_back();
+        }
+        break;
+      case Expression::Ap:
+        if(done == 0){
+          output.put("[\"app\",");
+          stack.push_back(make_pair(&Expression::at(expr.body), 0));
+        }else if(done == 1){
+          output.put(",");
+          stack.push_back(make_pair(&Expression::at(expr.arg), 0));
+        }else{
+          output.put("]");
+          stack.pop_back();
+        }
+        break;
+      case Expression::Nothing:
+        cerr << "[Expression] Unexpected expression type: Nothing" << endl;
+        stack.pop_back();
+    }
+  }
+}
@@ -0,0 +1,23 @@
+#ifndef __ULC_JSON_HPP__
+#define __ULC_JSON_HPP__
+
+#include <iostream>
+
+#include "ExpressionParser.hpp"
+
+// Expressions as JSON arrays:
+//   ["int",n]  ["var","name"]  ["lam","name",body]  ["app",f,x]
+//
+// Both directions keep their own stack instead of recursing, so the depth
+// of an expression is only bounded by memory, and go through buffers of
+// their own.
+namespace Json{
+
+// Build the expression read from `fd` until its end, straight into the
+// expression pool
+Expression::Ref read(int fd);
+void write(const Expression& expr, std::ostream& out);
+
+}
+
+#endif
@@ -0,0 +1,264 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "Machine.hpp"
+#include "Stats.hpp"
+#include "Governor.hpp"
+#include "Parallel.hpp"
+
+using namespace std;
+
+namespace{
+
+struct Continuation{
+  enum Kind{
+    // Apply the value to `obj`
+    Apply,
+    // Write the weak head normal form back into the top frame of `slot`
+    Update,
+    // The value is the normal form of the body of the lambda `obj`
+    Abstract,
+    // The value is the normal form of the argument of the stuck `obj`
+    Neutral,
+    // The value is the argument of the lambda `obj`, evaluated as its body
+    // needs it anyway
+    Bind,
+    // The value is an operand of the primitive `obj`, to be put in the
+    // `Apply` continuation at `position`
+    Operand
+  } kind;
+  // Evaluate the result of an `Apply`, or the updated value, to normal form
+  bool strong;
+  Object obj;
+  Context slot;
+  size_t position;
+
+  Continuation(Kind k, bool s, const Object& o, size_t p = 0) : kind(k), strong(s), obj(o), position(p) {}
+  Continuation(bool s, const Context& c) : kind(Update), strong(s), obj(Expression()), slot(c), position(0) {}
+};
+
+// The `n` continuations on top of the stack all apply the value
+bool saturated(const vector<Continuation>& stack, int n){
+  if(stack.size() < (size_t)n) return false;
+  for(size_t i = stack.size() - n; i < stack.size(); ++i)
+    if(stack[i].kind != Continuation::Apply) return false;
+  return true;
+}
+
+// Natives reading their operands as numbers, the machine evaluates those
+// before the call rather than have the native re-enter it. `*` does not
+// need its second operand when the first one is 0.
+// Not a thunk any more
+bool evaluated(const Object& obj){
+  return obj.type() != Object::Closure || obj.expr().isLam();
+}
+
+// The position in `stack` of the next operand to evaluate of the primitive
+// `prim`, applied to none yet, its operands being the `Apply` continuations
+// on top, the first one topmost; None if they are all evaluated
+const size_t None = SIZE_MAX;
+
+size_t nextOperand(const vector<Continuation>& stack, const Object& prim){
+  size_t first = stack.size() - 1;
+  for(int i = 0; i < prim.missing(); ++i){
+    const Object& operand = stack[first - i].obj;
+    if(!evaluated(operand)) return first - i;
+    if(i == 0 && prim.native()->operation == Native::Mul && operand.isNormalForm()
+        && operand.expr().isNum() && operand.expr().val == 0)
+      break;
+  }
+  return None;
+}
+
+}
+
+Object Machine::evaluate(const Expression& expr, const Context& env, bool strong){
+  // Re-entered by the natives
+  Governor::deep();
+  vector<Continuation> stack;
+  Object control(expr, env);
+  Object value((Expression()));
+  // Arguments of the primitive being called
+  vector<Object> args;
+  bool eval = true;
+
+  while(true){
+    if(eval && control.isPrimitive()){
+      value = control;
+      eval = false;
+      if(strong){
+        // Read back as its name applied to the arguments it has collected,
+        // the first one on top
+        value = makeNormalForm(control.expr());
+        for(int i = 0; i < control.applied(); ++i)
+          stack.emplace_back(Continuation::Apply, true, control.env()[i]);
+      }
+      continue;
+    }
+    if(eval){
+      const Expression& e = control.expr();
+      switch( e.type ){
+        case Expression::Constant:
+          value = makeNormalForm( e );
+          eval = false;
+          break;
+        case Expression::Var:
+          if( e.index < 0 ){
+            value = makeNormalForm( e );
+            eval = false;
+          }else{
+            STATS(++Stats::lookups);
+            Object& res = control.env()[e.index];
+            if( res.isNormalForm() ){
+              value = res;
+              eval = false;
+            }else if( res.isPrimitive() ){
+              control = res;
+            }else{
+              Object thunk = enterThunk(res);
+              if( thunk.isNormalForm() ){
+                value = thunk;
+                eval = false;
+              }else if( thunk.isPrimitive() ){
+                control = thunk;
+              }else{
+                stack.emplace_back(strong, control.env().drop(e.index));
+                control = thunk;
+                strong = false;
+              }
+            }
+          }
+          break;
+        case Expression::Lambda:
+          if( !strong ){
+            value = control;
+            eval = false;
+          }else{
+            // The bound variable stays a free, named variable in the normal form
+            Expression var(Expression::Var);
+            var.name = e.name;
+            Context env2 = control.env().insert(makeNormalForm(var));
+            stack.emplace_back(Continuation::Abstract, true, control);
+            control = Object(Expression::at(stack.back().obj.expr().body), env2);
+          }
+          break;
+        case Expression::Ap:
+          stack.emplace_back(Continuation::Apply, strong, Object(Expression::at(e.arg), control.env()));
+          control = Object(Expression::at(e.body), control.env());
+          strong = false;
+          break;
+        case Expression::Nothing:
+          cerr << "[Machine] Unexpected expression type: " << (int)e.type << endl;
+          exit(1);
+      }
+      continue;
+    }
+
+    if(stack.empty())
+      return value;
+    STATS(Stats::depth(stack.size()));
+    Continuation k(stack.back());
+    stack.pop_back();
+    switch( k.kind ){
+      case Continuation::Update:
+        updateThunk(k.slot[0], value);
+        if( k.strong && !value.isNormalForm() ){
+          control = value;
+          strong = true;
+          eval = true;
+        }
+        break;
+      case Continuation::Apply:
+        if( value.missing() > 0 && value.applied() == 0 && value.native()->numeric() && saturated(stack, value.missing() - 1) ){
+          stack.push_back(k);
+          size_t position = nextOperand(stack, value);
+          if( position != None ){
+            Object operand = stack[position].obj;
+            // With several threads the second operand is sparked while the
+            // first one is evaluated, then joined through its frame
+            if( Parallel::threads() > 1 && position == stack.size() - 1 && value.missing() > 1 ){
+              Object& second = stack[position - 1].obj;
+              if( !evaluated(second) && !second.expr().isNum() ){
+                const Expression& e = second.expr();
+                Context frame = e.isVar() && e.index >= 0 ? second.env().drop(e.index) : Context().insert(second);
+                Parallel::spark(frame);
+                Expression var(Expression::Var);
+                var.index = 0;
+                second = Object(var, frame);
+              }
+            }
+            stack.emplace_back(Continuation::Operand, false, value, position);
+            control = operand;
+            strong = false;
+            eval = true;
+            break;
+          }
+          stack.pop_back();
+        }
+        if( value.missing() > 1 && saturated(stack, value.missing() - 1) ){
+          // The primitive has all of its arguments, the last one deepest
+          int more = value.missing() - 1;
+          args.clear();
+          for(size_t i = stack.size() - more; i < stack.size(); ++i)
+            args.push_back(stack[i].obj);
+          args.push_back(k.obj);
+          strong = stack[stack.size() - more].strong;
+          stack.erase(stack.end() - more, stack.end());
+          Object res = value.saturate(args.data());
+          if( res.isNormalForm() ){
+            value = res;
+          }else{
+            control = res;
+            eval = true;
+          }
+        }else if( value.demands() && saturated(stack, value.demands() - 1) ){
+          stack.emplace_back(Continuation::Bind, k.strong, value);
+          control = k.obj;
+          strong = false;
+          eval = true;
+        }else if( value.callable() ){
+          Object res = value.call(k.obj.expr(), k.obj.env());
+          if( res.isNormalForm() ){
+            value = res;
+          }else{
+            control = res;
+            strong = k.strong;
+            eval = true;
+          }
+        }else{
+          stack.emplace_back(Continuation::Neutral, true, value);
+          control = k.obj;
+          strong = true;
+          eval = true;
+        }
+        break;
+      case Continuation::Neutral:
+        {
+          Expression expr2(Expression::Ap);
+          expr2.body = Expression::make(k.obj.expr());
+          expr2.arg = Expression::make(value.expr());
+          value = makeNormalForm( expr2 );
+        }
+        break;
+      case Continuation::Abstract:
+        {
+          Expression expr2(k.obj.expr());
+          expr2.body = Expression::make(value.expr());
+          value = makeNormalForm( expr2 );
+        }
+        break;
+      case Continuation::Bind:
+        control = k.obj.bind(value);
+        strong = k.strong;
+        eval = true;
+        break;
+      case Continuation::Operand:
+        // Back to the primitive, for its next operand or the call
+        stack[k.position].obj = value;
+        value = k.obj;
+        break;
+    }
+  }
+}
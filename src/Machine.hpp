@@ -0,0 +1,20 @@
+#ifndef __ULC_MACHINE_HPP__
+#define __ULC_MACHINE_HPP__
+
+#include "Runtime.hpp"
+
+// Abstract machine evaluating an expression with an explicit stack of
+// continuations instead of C++ recursion.
+// It follows `weakNormalForm`/`normalForm` step by step: the callee of an
+// application is reduced to weak head normal form, the argument is pushed
+// as a closure, variables are forced and updated in place. The operands
+// of arithmetic are evaluated before the call, only the other primitives
+// forcing their arguments re-enter the machine.
+namespace Machine{
+
+// Evaluate to normal form if `strong`, else to weak head normal form
+Object evaluate(const Expression& expr, const Context& env, bool strong);
+
+}
+
+#endif
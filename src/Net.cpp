@@ -0,0 +1,640 @@
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+#include "Net.hpp"
+#include "Stats.hpp"
+#include "Governor.hpp"
+
+using namespace std;
+
+namespace{
+
+// A port is a node and one of its slots, slot 0 is the principal port
+using Port = uint32_t;
+const Port NoPort = ~0u;
+
+Port port(uint32_t node, int slot) { return node << 2 | slot;}
+uint32_t nodeOf(Port p) { return p >> 2;}
+int slotOf(Port p) { return p & 3;}
+
+enum class Kind : uint8_t{
+  Root, Lam, App, Fan, Croissant, Bracket, Era, Num, Free, Op, Force,
+  // Stands for a shared term until all of its uses are known
+  Wire,
+  Dead
+};
+
+// The natives of the operations met, to read them back
+const Native * operations[Native::Le + 1];
+
+// The other primitives are translated as the lambda terms they stand for
+struct Term{
+  const char * name;
+  const char * source;
+};
+const Term terms[] = {
+  {"Y", "\\f (\\x f (x x)) (\\x f (x x))"},
+  {":", "\\x \\xs \\s \\z s x xs"},
+  {"head", "\\x x (\\a \\_ a) _"},
+  {"tail", "\\x x (\\_ \\b b) _"},
+  {"empty?", "\\x x (\\_ \\_ \\a \\b b) (\\a \\b a)"},
+  {"par", "\\a \\b b"},
+};
+
+// Lam: 1 the variable, 2 the body
+// App: 1 the argument, 2 the result
+// Fan: 1 and 2 the copies
+// Croissant and Bracket: 0 toward the binder, 1 toward the occurrence
+// Force: the primitive waiting for the number at 0, 1 the result
+struct Node{
+  Kind kind;
+  Native::Operation prim;
+  // An `Op` or a `Force` holding the first operand in `value`
+  bool applied;
+  // Name of a `Lam` or of a `Free` variable
+  Symbol name;
+  // Nesting level of the node, nodes only pair up within one level
+  int level;
+  // Value of a `Num`
+  int value;
+  Port ports[3];
+};
+
+int arity(Kind k){
+  switch(k){
+    case Kind::Lam:
+    case Kind::App:
+    case Kind::Fan:
+      return 2;
+    case Kind::Croissant:
+    case Kind::Bracket:
+    case Kind::Force:
+    case Kind::Wire:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+bool control(Kind k){
+  return k == Kind::Fan || k == Kind::Croissant || k == Kind::Bracket;
+}
+
+// Change of level of the nodes a control node of kind `k` goes through
+int shift(Kind k){
+  return k == Kind::Croissant ? -1 : k == Kind::Bracket ? 1 : 0;
+}
+
+// Readback context: one stack of fan choices per level, croissants and
+// brackets open and merge levels
+struct Level{
+  enum Type{Choice, Pair, Star} type;
+  int choice;
+  shared_ptr<const Level> first, second;
+};
+using Path = vector<shared_ptr<const Level>>;
+
+class InteractionNet{
+    vector<Node> nodes;
+    vector<uint32_t> freeNodes;
+
+  public:
+    // Node 0, its port 0 is linked to the term
+    static const uint32_t root = 0;
+
+    InteractionNet() { make(Kind::Root, 0);}
+
+    uint32_t make(Kind kind, int level){
+      Node node = {kind, Native::None, false, 0, level, 0, {NoPort, NoPort, NoPort}};
+      if(!freeNodes.empty()){
+        uint32_t n = freeNodes.back();
+        freeNodes.pop_back();
+        nodes[n] = node;
+        return n;
+      }
+      nodes.push_back(node);
+      return nodes.size() - 1;
+    }
+
+    uint32_t clone(uint32_t n){
+      uint32_t c = make(nodes[n].kind, 0);
+      nodes[c] = nodes[n];
+      return c;
+    }
+
+    void release(uint32_t n){
+      nodes[n].kind = Kind::Dead;
+      freeNodes.push_back(n);
+    }
+
+    Node& operator [] (uint32_t n) { return nodes[n];}
+    Kind kind(uint32_t n) const { return nodes[n].kind;}
+
+    Port neighbor(Port p) const { return nodes[nodeOf(p)].ports[slotOf(p)];}
+    void link(Port a, Port b){
+      nodes[nodeOf(a)].ports[slotOf(a)] = b;
+      nodes[nodeOf(b)].ports[slotOf(b)] = a;
+    }
+
+    // Put a croissant or a bracket on the wire ending at `end`, return the
+    // new end
+    Port wrap(Kind kind, int level, Port end){
+      uint32_t n = make(kind, level);
+      link(port(n, 1), end);
+      return port(n, 0);
+    }
+
+    // Join the wires ending at `a` and `b` by a fan, return the shared end
+    Port contract(int level, Port a, Port b){
+      uint32_t fan = make(Kind::Fan, level);
+      link(port(fan, 1), a);
+      link(port(fan, 2), b);
+      return port(fan, 0);
+    }
+
+    void erase(Port end){
+      link(end, port(make(Kind::Era, 0), 0));
+    }
+
+    bool active(uint32_t a, uint32_t b) const {
+      Kind x = kind(a), y = kind(b);
+      if(x > y) swap(x, y);
+      if(x == Kind::Root) return false;
+      if(control(x) || control(y) || x == Kind::Era || y == Kind::Era) return true;
+      return (x == Kind::Lam && y == Kind::App) || (x == Kind::App && y == Kind::Op) || (x == Kind::Num && y == Kind::Force);
+    }
+
+    void rewrite(uint32_t a, uint32_t b){
+      if(kind(a) > kind(b)) swap(a, b);
+      Kind x = kind(a), y = kind(b);
+      if(x == Kind::Lam && y == Kind::App){
+        Governor::step();
+        STATS(Stats::beta(nullptr));
+        annihilate(a, b);
+      }else if(x == y && control(x) && nodes[a].level == nodes[b].level)
+        annihilate(a, b);
+      else if(x == Kind::App && y == Kind::Op)
+        call(a, b);
+      else if(x == Kind::Num && y == Kind::Force)
+        compute(b, a);
+      else
+        commute(a, b);
+    }
+
+    // Beta reduction, or two control nodes of one kind and level meeting
+    void annihilate(uint32_t a, uint32_t b){
+      for(int i = arity(kind(a)); i >= 1; --i)
+        link(neighbor(port(a, i)), neighbor(port(b, i)));
+      release(a);
+      release(b);
+    }
+
+    // Each node passes through the other, copying it on every port it had.
+    // The copies of the node of higher level are shifted by the other one.
+    void commute(uint32_t a, uint32_t b){
+      int ka = arity(kind(a)), kb = arity(kind(b));
+      Port an[2], bn[2];
+      uint32_t ac[2], bc[2];
+      for(int i = 0; i < ka; ++i) an[i] = neighbor(port(a, 1 + i));
+      for(int j = 0; j < kb; ++j) bn[j] = neighbor(port(b, 1 + j));
+      for(int i = 0; i < ka; ++i) bc[i] = clone(b);
+      for(int j = 0; j < kb; ++j) ac[j] = clone(a);
+      if(nodes[a].level < nodes[b].level)
+        for(int i = 0; i < ka; ++i) nodes[bc[i]].level += shift(kind(a));
+      if(nodes[b].level < nodes[a].level)
+        for(int j = 0; j < kb; ++j) nodes[ac[j]].level += shift(kind(b));
+      // A wire between two ports of the pair now joins their copies
+      auto moved = [&](Port p){
+        if(nodeOf(p) == a) return port(bc[slotOf(p) - 1], 0);
+        if(nodeOf(p) == b) return port(ac[slotOf(p) - 1], 0);
+        return p;
+      };
+      for(int i = 0; i < ka; ++i) link(port(bc[i], 0), moved(an[i]));
+      for(int j = 0; j < kb; ++j) link(port(ac[j], 0), moved(bn[j]));
+      for(int i = 0; i < ka; ++i)
+        for(int j = 0; j < kb; ++j)
+          link(port(bc[i], 1 + j), port(ac[j], 1 + i));
+      release(a);
+      release(b);
+    }
+
+    // A primitive applied to an argument waits for it to be a number
+    void call(uint32_t app, uint32_t op){
+      Port arg = neighbor(port(app, 1)), res = neighbor(port(app, 2));
+      int level = nodes[app].level;
+      Node prim = nodes[op];
+      release(app);
+      release(op);
+      if(prim.applied && prim.prim == Native::Mul && prim.value == 0){
+        erase(arg);
+        number(res, 0);
+        return ;
+      }
+      uint32_t force = make(Kind::Force, level);
+      nodes[force].prim = prim.prim;
+      nodes[force].applied = prim.applied;
+      nodes[force].value = prim.value;
+      link(port(force, 0), arg);
+      link(port(force, 1), res);
+    }
+
+    void compute(uint32_t force, uint32_t num){
+      Governor::step();
+      Port res = neighbor(port(force, 1));
+      Node prim = nodes[force];
+      int b = nodes[num].value;
+      release(force);
+      release(num);
+      if(!prim.applied){
+        uint32_t op = make(Kind::Op, prim.level);
+        nodes[op].prim = prim.prim;
+        nodes[op].applied = true;
+        nodes[op].value = b;
+        link(port(op, 0), res);
+        return ;
+      }
+      int a = prim.value;
+      switch(prim.prim){
+        case Native::Add: number(res, a + b); break;
+        case Native::Sub: number(res, a - b); break;
+        case Native::Mul: number(res, a * b); break;
+        case Native::Div: number(res, a / b); break;
+        case Native::Mod: number(res, a % b); break;
+        case Native::Eq: boolean(res, prim.level, a == b); break;
+        case Native::Lt: boolean(res, prim.level, a < b); break;
+        case Native::Le: boolean(res, prim.level, a <= b); break;
+        case Native::None: break;
+      }
+    }
+
+    void number(Port res, int v){
+      uint32_t num = make(Kind::Num, 0);
+      nodes[num].value = v;
+      link(port(num, 0), res);
+    }
+
+    // \a \b a, or \a \b b
+    void boolean(Port res, int level, bool b){
+      static const Symbol nameA = intern("a"), nameB = intern("b");
+      uint32_t outer = make(Kind::Lam, level), inner = make(Kind::Lam, level);
+      nodes[outer].name = nameA;
+      nodes[inner].name = nameB;
+      link(port(outer, 0), res);
+      link(port(outer, 2), port(inner, 0));
+      uint32_t used = b ? outer : inner;
+      link(port(used, 1), wrap(Kind::Croissant, level, port(inner, 2)));
+      erase(port(b ? inner : outer, 1));
+    }
+
+    // Walk from the root toward the principal ports, reducing the active
+    // pairs met on the way, then go on with the ports below the nodes in
+    // normal form. Heads are reduced before arguments.
+    void reduce(){
+      vector<Port> warp;
+      // The ports we came up through, from the last warp on
+      vector<Port> entered;
+      // Generation of the last rewrite at which each warp port was taken.
+      // Past a stuck pair, the ports left to see may lead through fans back
+      // to the same stuck term: each one is taken once between rewrites.
+      vector<uint32_t> taken;
+      uint32_t generation = 1;
+      Port next = neighbor(port(root, 0));
+      while(true){
+        if(next == NoPort){
+          if(warp.empty()) break;
+          Port from = warp.back();
+          warp.pop_back();
+          entered.clear();
+          if(kind(nodeOf(from)) == Kind::Dead) continue;
+          if(taken.size() <= from) taken.resize(max<size_t>(from + 1, taken.size() * 2), 0);
+          if(taken[from] == generation) continue;
+          taken[from] = generation;
+          next = neighbor(from);
+        }
+        uint32_t n = nodeOf(next);
+        if(n == root){
+          next = NoPort;
+          continue;
+        }
+        if(slotOf(next) != 0){
+          // Move on to the principal port of this node
+          entered.push_back(next);
+          next = neighbor(port(n, 0));
+          continue;
+        }
+        Port prev = neighbor(next);
+        uint32_t p = nodeOf(prev);
+        if(slotOf(prev) == 0 && p != root){
+          if(active(p, n)){
+            Port back = neighbor(entered.back());
+            entered.pop_back();
+            rewrite(p, n);
+            ++generation;
+            if(nodeOf(back) == p || nodeOf(back) == n){
+              next = neighbor(port(root, 0));
+              entered.clear();
+            }else{
+              next = neighbor(back);
+            }
+            continue;
+          }
+          // Stuck, the other ports of the nodes we came up through are left
+          // to see. Those above a lambda were seen from the lambda.
+          for(size_t i = entered.size(); i-- > 0 && kind(nodeOf(entered[i])) != Kind::Lam; ){
+            uint32_t m = nodeOf(entered[i]);
+            for(int s = arity(kind(m)); s >= 1; --s)
+              if(s != slotOf(entered[i])) warp.push_back(port(m, s));
+          }
+        }
+        int k = arity(kind(n));
+        if(k == 2) warp.push_back(port(n, 2));
+        next = k ? neighbor(port(n, 1)) : NoPort;
+      }
+    }
+
+    // The primitive of an `Op` or a `Force`, with its first operand if any
+    static Expression::Ref primitive(const Node& node){
+      Expression var(operations[node.prim]->name);
+      if(!node.applied)
+        return Expression::make(var);
+      Expression ap(Expression::Ap);
+      ap.body = Expression::make(var);
+      ap.arg = Expression::make(Expression(node.value));
+      return Expression::make(ap);
+    }
+
+    // Expression of the term whose output is `p`. `path` records how the
+    // control nodes were crossed, it tells which copy a fan leads to.
+    Expression::Ref readback(Port p, Path path){
+      while(control(kind(nodeOf(p)))){
+        uint32_t n = nodeOf(p);
+        const Node& node = nodes[n];
+        size_t i = node.level;
+        if(path.size() < i + 2) path.resize(i + 2);
+        if(slotOf(p) != 0){
+          switch(node.kind){
+            case Kind::Fan:
+              path[i] = make_shared<const Level>(Level{Level::Choice, slotOf(p), path[i], nullptr});
+              break;
+            case Kind::Croissant:
+              path.insert(path.begin() + i, make_shared<const Level>(Level{Level::Star, 0, nullptr, nullptr}));
+              break;
+            default:
+              path[i] = make_shared<const Level>(Level{Level::Pair, 0, path[i], path[i + 1]});
+              path.erase(path.begin() + i + 1);
+              break;
+          }
+          p = neighbor(port(n, 0));
+          continue;
+        }
+        int slot = 1;
+        switch(node.kind){
+          case Kind::Fan:
+            if(path[i] && path[i]->type == Level::Choice){
+              slot = path[i]->choice;
+              path[i] = path[i]->first;
+            }
+            break;
+          case Kind::Croissant:
+            path.erase(path.begin() + i);
+            break;
+          default:
+            if(path[i] && path[i]->type == Level::Pair){
+              path.insert(path.begin() + i + 1, path[i]->second);
+              path[i] = path[i]->first;
+            }else{
+              path.insert(path.begin() + i + 1, nullptr);
+            }
+            break;
+        }
+        p = neighbor(port(n, slot));
+      }
+      uint32_t n = nodeOf(p);
+      Node node = nodes[n];
+      switch(node.kind){
+        case Kind::Lam:
+          if(slotOf(p) == 1){
+            Expression var(Expression::Var);
+            var.name = node.name;
+            return Expression::make(var);
+          }
+          if(slotOf(p) == 0){
+            Expression lam(Expression::Lambda);
+            lam.name = node.name;
+            lam.body = readback(neighbor(port(n, 2)), path);
+            return Expression::make(lam);
+          }
+          break;
+        case Kind::App:
+          if(slotOf(p) == 2){
+            Expression ap(Expression::Ap);
+            ap.body = readback(neighbor(port(n, 0)), path);
+            ap.arg = readback(neighbor(port(n, 1)), path);
+            return Expression::make(ap);
+          }
+          break;
+        case Kind::Num:
+          return Expression::make(Expression(node.value));
+        case Kind::Free:
+          {
+            Expression var(Expression::Var);
+            var.name = node.name;
+            return Expression::make(var);
+          }
+        case Kind::Op:
+          return primitive(node);
+        case Kind::Force:
+          // Stuck on an argument that is not a number
+          if(slotOf(p) == 1){
+            Expression ap(Expression::Ap);
+            ap.body = primitive(node);
+            ap.arg = readback(neighbor(port(n, 0)), path);
+            return Expression::make(ap);
+          }
+          break;
+        default:
+          break;
+      }
+      cerr << "[Net] Unexpected node in the normal form: " << (int)node.kind << endl;
+      exit(1);
+    }
+};
+
+// Translation of Gonthier, Abadi and Levy. The argument of an application
+// of level n is a box of level n + 1 and its free variables leave the box
+// through brackets of level n. An occurrence of a variable is a croissant
+// of its level, the occurrences are joined by fans of the level of the
+// application where they meet.
+class Translator{
+    // End of the wire of each free variable of a term: local binders by
+    // depth, frames of the context by -1 - their number
+    using Wires = map<int, Port>;
+
+    struct Shared{
+      uint32_t wire;
+      Object value;
+      Symbol name;
+      vector<Port> uses;
+    };
+
+    InteractionNet& net;
+    // The frames of the context met so far, by the address of their value
+    unordered_map<const Object *, int> frameIndex;
+    vector<Shared> frames;
+
+    int useFrame(const Context& env, int index){
+      const Object& value = env[index];
+      auto it = frameIndex.find(&value);
+      if(it != frameIndex.end())
+        return it->second;
+      frames.push_back(Shared{net.make(Kind::Wire, 0), value, env.name(index), vector<Port>()});
+      return frameIndex[&value] = frames.size() - 1;
+    }
+
+    // Build the net of `expr` at `level` and connect its output to `into`
+    Wires translate(const Expression& expr, const Context& env, int depth, int level, Port into){
+      Wires wires;
+      switch(expr.type){
+        case Expression::Constant:
+          net.number(into, expr.val);
+          break;
+        case Expression::Var:
+          if(expr.index < 0){
+            uint32_t free = net.make(Kind::Free, level);
+            net[free].name = expr.name;
+            net.link(port(free, 0), into);
+          }else{
+            int key = expr.index < depth ? depth - 1 - expr.index : -1 - useFrame(env, expr.index - depth);
+            wires[key] = net.wrap(Kind::Croissant, level, into);
+          }
+          break;
+        case Expression::Lambda:
+          {
+            uint32_t lam = net.make(Kind::Lam, level);
+            net[lam].name = expr.name;
+            net.link(port(lam, 0), into);
+            wires = translate(Expression::at(expr.body), env, depth + 1, level, port(lam, 2));
+            auto it = wires.find(depth);
+            if(it == wires.end()){
+              net.erase(port(lam, 1));
+            }else{
+              net.link(port(lam, 1), it->second);
+              wires.erase(it);
+            }
+          }
+          break;
+        case Expression::Ap:
+          {
+            uint32_t app = net.make(Kind::App, level);
+            net.link(port(app, 2), into);
+            wires = translate(Expression::at(expr.body), env, depth, level, port(app, 0));
+            Wires arg = translate(Expression::at(expr.arg), env, depth, level + 1, port(app, 1));
+            for(auto& wire : arg){
+              Port end = net.wrap(Kind::Bracket, level, wire.second);
+              auto it = wires.find(wire.first);
+              if(it == wires.end())
+                wires[wire.first] = end;
+              else
+                it->second = net.contract(level, it->second, end);
+            }
+          }
+          break;
+        case Expression::Nothing:
+          cerr << "[Net] Unexpected expression type: " << (int)expr.type << endl;
+          exit(1);
+      }
+      return wires;
+    }
+
+    // The value of a frame is the argument of a redex of level 0
+    Wires translateFrame(const Shared& frame){
+      Port into = port(frame.wire, 0);
+      const Object& value = frame.value;
+      if(value.isPrimitive()){
+        const string& name = symbolName(frame.name);
+        const Native& native = *value.native();
+        // The net cannot order effects. Met while the net is built, before
+        // any reduction.
+        if(native.effect){
+          cerr << "[Net] The net engine does not support IO, the program uses " << name << endl;
+          exit(1);
+        }
+        for(int i = 0; i < 6; ++i){
+          if(name == terms[i].name){
+            static vector<Object> closed;
+            if(closed.empty()){
+              for(const Term& term : terms){
+                Scanner scanner(term.source);
+                Expression& expr = Expression::at(parseExpression(scanner));
+                Context().resolve(expr);
+                closed.push_back(Object(expr));
+              }
+            }
+            return translate(closed[i].expr(), closed[i].env(), 0, 1, into);
+          }
+        }
+        if(native.numeric()){
+          operations[native.operation] = &native;
+          uint32_t op = net.make(Kind::Op, 1);
+          net[op].prim = native.operation;
+          net.link(port(op, 0), into);
+          return Wires();
+        }
+        cerr << "[Net] Unsupported primitive: " << name << endl;
+        exit(1);
+      }
+      if(value.isNormalForm() && value.expr().isLam()){
+        cerr << "[Net] Unsupported normal form in the context" << endl;
+        exit(1);
+      }
+      if(value.isBlackhole()){
+        cerr << "[Net] Context under evaluation" << endl;
+        exit(1);
+      }
+      return translate(value.expr(), value.env(), 0, 1, into);
+    }
+
+  public:
+    Translator(InteractionNet& n) : net(n) {}
+
+    void translate(const Expression& expr, const Context& env){
+      Wires wires = translate(expr, env, 0, 0, port(InteractionNet::root, 0));
+      for(auto& wire : wires)
+        frames[-1 - wire.first].uses.push_back(wire.second);
+      for(size_t i = 0; i < frames.size(); ++i){
+        Shared frame = frames[i];
+        for(auto& wire : translateFrame(frame))
+          frames[-1 - wire.first].uses.push_back(net.wrap(Kind::Bracket, 0, wire.second));
+      }
+      // Every use of the frames is known now, share them
+      for(Shared& frame : frames){
+        Port source = net.neighbor(port(frame.wire, 0));
+        net.release(frame.wire);
+        vector<Port>& uses = frame.uses;
+        if(uses.empty()){
+          net.erase(source);
+          continue;
+        }
+        while(uses.size() > 1){
+          Port b = uses.back();
+          uses.pop_back();
+          uses.back() = net.contract(0, uses.back(), b);
+        }
+        net.link(source, uses.back());
+      }
+    }
+};
+
+}
+
+Object Net::normalForm(const Expression& expr, const Context& env){
+  InteractionNet net;
+  Translator(net).translate(expr, env);
+  net.reduce();
+  return makeNormalForm(Expression::at(net.readback(net.neighbor(port(InteractionNet::root, 0)), Path())));
+}
@@ -0,0 +1,23 @@
+#ifndef __ULC_NET_HPP__
+#define __ULC_NET_HPP__
+
+#include "Runtime.hpp"
+
+// Optimal reduction by interaction nets, after Lamping's algorithm.
+// The expression is translated into a net of lambda, application and fan
+// nodes: every variable used more than once is shared by a tree of fans,
+// which duplicate whatever flows into them one interaction at a time, so
+// work under lambdas is shared instead of copied. Croissants and brackets
+// keep the nesting level of each node, fans of one level pair up.
+// The net is reduced from the root, head first, and read back.
+//
+// Numbers and the arithmetic and comparison primitives are nodes of the
+// net too. Other primitives, the IO ones among them, are not supported.
+namespace Net{
+
+// Normal form of `expr` in `env`
+Object normalForm(const Expression& expr, const Context& env);
+
+}
+
+#endif
@@ -0,0 +1,296 @@
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <unordered_set>
+
+#include "Optimizer.hpp"
+
+using namespace std;
+
+namespace{
+
+using Ref = Expression::Ref;
+
+// Deepest nesting walked by the recursive passes below
+const int Deep = 10000;
+
+struct Uses{
+  int count;
+  bool underLambda;
+};
+
+class Pass{
+    const Context& prelude;
+    int level;
+    // Lambdas no larger than this are inlined wherever they are used
+    size_t small;
+    // Height of the expression at each ref, 0 if not known yet
+    vector<uint32_t> heights;
+    // Names of the lambdas above the expression being optimized
+    vector<Symbol> binders;
+
+  public:
+    bool changed;
+
+    Pass(const Context& p, int l) : prelude(p), level(l), small(l >= 2 ? 64 : 16), changed(false) {}
+
+    uint32_t known(Ref ref) const { return ref < heights.size() ? heights[ref] : 0;}
+
+    uint32_t height(Ref ref){
+      vector<pair<Ref, bool>> pending(1, make_pair(ref, false));
+      while(!pending.empty()){
+        Ref r = pending.back().first;
+        bool ready = pending.back().second;
+        pending.pop_back();
+        if(known(r)) continue;
+        const Expression expr = Expression::at(r);
+        bool lam = expr.isLam(), ap = expr.isAp();
+        if(!ready && (lam || ap)){
+          pending.emplace_back(r, true);
+          pending.emplace_back(expr.body, false);
+          if(ap) pending.emplace_back(expr.arg, false);
+          continue;
+        }
+        uint32_t h = 1;
+        if(lam || ap) h = max(h, known(expr.body) + 1);
+        if(ap) h = max(h, known(expr.arg) + 1);
+        if(heights.size() <= r)
+          heights.resize(max<size_t>(r + 1, heights.size() * 2), 0);
+        heights[r] = h;
+      }
+      return heights[ref];
+    }
+
+    // `ref` with the variables bound above `cutoff` binders moved by `d`
+    Ref shift(Ref ref, int d, int cutoff){
+      Expression expr = Expression::at(ref);
+      switch(expr.type){
+        case Expression::Var:
+          if(expr.index < cutoff) return ref;
+          expr.index += d;
+          return Expression::make(expr);
+        case Expression::Lambda:
+          {
+            Ref body = shift(expr.body, d, cutoff + 1);
+            if(body == expr.body) return ref;
+            expr.body = body;
+            return Expression::make(expr);
+          }
+        case Expression::Ap:
+          {
+            Ref body = shift(expr.body, d, cutoff), arg = shift(expr.arg, d, cutoff);
+            if(body == expr.body && arg == expr.arg) return ref;
+            expr.body = body;
+            expr.arg = arg;
+            return Expression::make(expr);
+          }
+        default:
+          return ref;
+      }
+    }
+
+    // `ref` with the variable bound `depth` binders above put to `value`,
+    // and that binder removed
+    Ref substitute(Ref ref, Ref value, int depth){
+      Expression expr = Expression::at(ref);
+      switch(expr.type){
+        case Expression::Var:
+          if(expr.index == depth) return shift(value, depth, 0);
+          if(expr.index < depth) return ref;
+          expr.index -= 1;
+          return Expression::make(expr);
+        case Expression::Lambda:
+          expr.body = substitute(expr.body, value, depth + 1);
+          return Expression::make(expr);
+        case Expression::Ap:
+          expr.body = substitute(expr.body, value, depth);
+          expr.arg = substitute(expr.arg, value, depth);
+          return Expression::make(expr);
+        default:
+          return ref;
+      }
+    }
+
+    // The first `applied` lambdas on top of `ref` are known to be applied
+    // once, being under them repeats nothing
+    void uses(Ref ref, int depth, bool underLambda, int applied, Uses& found){
+      const Expression expr = Expression::at(ref);
+      if(expr.isVar() && expr.index == depth){
+        found.count += 1;
+        found.underLambda = found.underLambda || underLambda;
+      }else if(expr.isLam()){
+        uses(expr.body, depth + 1, underLambda || applied == 0, max(applied - 1, 0), found);
+      }else if(expr.isAp()){
+        uses(expr.body, depth, underLambda, 0, found);
+        uses(expr.arg, depth, underLambda, 0, found);
+      }
+    }
+
+    // Names of the variables bound outside of `ref`
+    void freeNames(Ref ref, int depth, unordered_set<Symbol>& names){
+      const Expression expr = Expression::at(ref);
+      if(expr.isVar() && (expr.index < 0 || expr.index >= depth)){
+        names.insert(expr.name);
+      }else if(expr.isLam()){
+        freeNames(expr.body, depth + 1, names);
+      }else if(expr.isAp()){
+        freeNames(expr.body, depth, names);
+        freeNames(expr.arg, depth, names);
+      }
+    }
+
+    bool binds(Ref ref, const unordered_set<Symbol>& names){
+      const Expression expr = Expression::at(ref);
+      if(expr.isLam())
+        return names.count(expr.name) || binds(expr.body, names);
+      if(expr.isAp())
+        return binds(expr.body, names) || binds(expr.arg, names);
+      return false;
+    }
+
+    // Nodes in `ref`, counting no further than `limit`
+    size_t size(Ref ref, size_t limit){
+      const Expression expr = Expression::at(ref);
+      size_t n = 1;
+      if((expr.isLam() || expr.isAp()) && n <= limit)
+        n += size(expr.body, limit - n);
+      if(expr.isAp() && n <= limit)
+        n += size(expr.arg, limit - n);
+      return n;
+    }
+
+    // Reduce `(lambda value)`, itself applied to `spine` more arguments,
+    // if no work gets repeated
+    bool reduce(const Expression& lambda, Ref value, int spine, Ref& result){
+      if(height(lambda.body) > Deep || height(value) > Deep) return false;
+      Uses found = {0, false};
+      uses(lambda.body, 0, false, spine, found);
+      const Expression arg = Expression::at(value);
+      bool worth = found.count == 0 || arg.isVar() || arg.isNum()
+        || (found.count == 1 && !found.underLambda)
+        || (arg.isLam() && (found.count == 1 || size(value, small) <= small));
+      if(!worth) return false;
+      if(found.count > 0){
+        unordered_set<Symbol> names;
+        freeNames(value, 0, names);
+        if(!names.empty() && binds(lambda.body, names)) return false;
+      }
+      result = substitute(lambda.body, value, 0);
+      return true;
+    }
+
+    // A constant for `(fun arg)` if it is an arithmetic native applied to
+    // constants only
+    bool fold(Ref fun, Ref arg, int depth, Ref& result){
+      // The last argument first, as natives take them
+      vector<Ref> operands(1, arg);
+      Ref head = fun;
+      for(; Expression::at(head).isAp(); head = Expression::at(head).body)
+        operands.push_back(Expression::at(head).arg);
+      const Expression var = Expression::at(head);
+      if(!var.isVar() || var.index < depth) return false;
+      if(!prelude.name(var.index - depth)) return false;
+      const Object& native = prelude[var.index - depth];
+      if(!native.isPrimitive() || !native.native()->foldable() || native.missing() != (int)operands.size())
+        return false;
+      for(Ref operand : operands)
+        if(!Expression::at(operand).isNum()) return false;
+      // Computed here rather than by the native, so that what would trap or
+      // overflow at run time is left to run time
+      int a = Expression::at(operands[1]).val, b = Expression::at(operands[0]).val, value;
+      switch(native.native()->operation){
+        case Native::Add:
+          if(__builtin_add_overflow(a, b, &value)) return false;
+          break;
+        case Native::Sub:
+          if(__builtin_sub_overflow(a, b, &value)) return false;
+          break;
+        case Native::Mul:
+          if(__builtin_mul_overflow(a, b, &value)) return false;
+          break;
+        default:
+          if(b == 0 || (a == INT_MIN && b == -1)) return false;
+          value = native.native()->operation == Native::Div ? a / b : a % b;
+      }
+      result = Expression::make(Expression(value));
+      return true;
+    }
+
+    // The rule of the prelude that `var` refers to, to be applied in its
+    // place: a small lambda, as `add` made it
+    bool unfold(const Expression& var, int depth, Ref& result){
+      if(!var.isVar() || var.index < depth) return false;
+      int k = var.index - depth;
+      if(!prelude.name(k)) return false;
+      const Object& rule = prelude[k];
+      if(rule.type() != Object::Closure || !rule.expr().isLam() || !(rule.env() == prelude.drop(k + 1)))
+        return false;
+      Ref lambda = Expression::make(rule.expr());
+      if(size(lambda, small) > small) return false;
+      unordered_set<Symbol> names;
+      freeNames(lambda, 0, names);
+      for(Symbol name : binders)
+        if(names.count(name)) return false;
+      // The rule sees the frames below its own
+      result = shift(lambda, depth + k + 1, 0);
+      return true;
+    }
+
+    // `depth` counts the binders above `ref`, `nesting` all of its parents
+    // and `spine` the arguments it is applied to
+    Ref optimize(Ref ref, int depth, int nesting, int spine){
+      if(nesting > Deep) return ref;
+      Expression expr = Expression::at(ref);
+      if(expr.isLam()){
+        binders.push_back(expr.name);
+        Ref body = optimize(expr.body, depth + 1, nesting + 1, 0);
+        binders.pop_back();
+        const Expression inner = Expression::at(body);
+        if(level >= 2 && inner.isAp() && Expression::at(inner.arg).isVar() && Expression::at(inner.arg).index == 0
+            && height(inner.body) <= Deep){
+          Uses found = {0, false};
+          uses(inner.body, 0, false, 0, found);
+          if(found.count == 0){
+            changed = true;
+            return shift(inner.body, -1, 0);
+          }
+        }
+        if(body == expr.body) return ref;
+        expr.body = body;
+        return Expression::make(expr);
+      }
+      if(expr.isAp()){
+        Ref fun = optimize(expr.body, depth, nesting + 1, spine + 1);
+        Ref arg = optimize(expr.arg, depth, nesting + 1, 0);
+        Ref result;
+        if(unfold(Expression::at(fun), depth, result)){
+          changed = true;
+          fun = result;
+        }
+        const Expression head = Expression::at(fun);
+        if((head.isLam() && reduce(head, arg, spine, result)) || (spine == 0 && fold(fun, arg, depth, result))){
+          changed = true;
+          return result;
+        }
+        if(fun == expr.body && arg == expr.arg) return ref;
+        expr.body = fun;
+        expr.arg = arg;
+        return Expression::make(expr);
+      }
+      return ref;
+    }
+};
+
+}
+
+Expression::Ref Optimizer::optimize(Expression::Ref program, const Context& prelude, int level){
+  // What a round exposes is taken by the next one
+  int rounds = level >= 2 ? 8 : level >= 1 ? 3 : 0;
+  for(int i = 0; i < rounds; ++i){
+    Pass pass(prelude, level);
+    program = pass.optimize(program, 0, 0, 0);
+    if(!pass.changed) break;
+  }
+  return program;
+}
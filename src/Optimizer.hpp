@@ -0,0 +1,26 @@
+#ifndef __ULC_OPTIMIZER_HPP__
+#define __ULC_OPTIMIZER_HPP__
+
+#include "Runtime.hpp"
+
+// Rewrites of a resolved program before it is evaluated.
+//
+// Level 1 reduces the redexes `(\x b) e` it knows to be worth it, which
+// covers `let`: when `x` is unused, when `e` is a variable or a constant,
+// when `e` is a lambda used once or small, or when `x` is used once and
+// not under a lambda, so that no work is repeated. It also folds the
+// arithmetic natives applied to constants, and applies the small rules
+// of the prelude, such as `if`, in place. Level 2 tries harder and
+// eta-reduces `\x f x` to `f`, which may show in the normal form.
+//
+// Nothing is done where a variable would move under a lambda of the same
+// name, it would print as that lambda's. Subterms nested deeper than the
+// C++ stack allows are left as they are.
+namespace Optimizer{
+
+// The optimized `program`, resolved in `prelude`; level 0 returns it
+Expression::Ref optimize(Expression::Ref program, const Context& prelude, int level);
+
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include <cstdlib>
+#include <iostream>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "Parallel.hpp"
+#include "Governor.hpp"
+
+using namespace std;
+
+namespace{
+
+struct Worker{
+  mutex lock;
+  deque<Context> sparks;
+};
+
+// Past this many sparks a thread keeps its work to itself
+const size_t MaxSparks = 4096;
+// Stack of the threads when that of the main thread has no limit
+const size_t LargeStack = size_t(1) << 30;
+
+unsigned threadCount = 1;
+// Never destroyed, the threads are left running when the program exits
+Worker * workers = nullptr;
+thread_local int index = 0;
+
+// Guards `paused` and `running`, the threads sleep on `work` while there
+// is nothing to steal or a collection runs
+mutex gate;
+condition_variable work;
+bool paused = false;
+// Threads taking or evaluating a spark
+unsigned running = 0;
+atomic<unsigned> pending(0);
+atomic<unsigned> sleeping(0);
+
+bool take(Context& spark){
+  for(unsigned k = 0; k < threadCount; ++k){
+    Worker& victim = workers[(index + k) % threadCount];
+    lock_guard<mutex> lock(victim.lock);
+    if(victim.sparks.empty()) continue;
+    // Our own newest spark, or the oldest of another thread
+    if(k == 0){
+      spark = victim.sparks.back();
+      victim.sparks.pop_back();
+    }else{
+      spark = victim.sparks.front();
+      victim.sparks.pop_front();
+    }
+    --pending;
+    return true;
+  }
+  return false;
+}
+
+void run(const Context& spark){
+  // The spark fizzles if its thunk was evaluated or entered meanwhile
+  if(spark[0].type() != Object::Closure)
+    return ;
+  Expression var(Expression::Var);
+  var.index = 0;
+  try{
+    weakNormalForm(var, spark);
+  }catch(const Parallel::Fizzle&){
+  }
+}
+
+// The threads recurse as deep as the main thread does, they get a stack
+// as large as its own
+size_t stackSize(){
+  rlimit limit;
+  if(getrlimit(RLIMIT_STACK, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+    return LargeStack;
+  return limit.rlim_cur;
+}
+
+void * loop(void * i){
+  index = reinterpret_cast<intptr_t>(i);
+  Governor::guardStack(stackSize());
+  unique_lock<mutex> lock(gate);
+  while(true){
+    ++sleeping;
+    work.wait(lock, []{ return !paused && pending > 0;});
+    --sleeping;
+    ++running;
+    lock.unlock();
+    {
+      Context spark;
+      if(take(spark))
+        run(spark);
+    }
+    lock.lock();
+    --running;
+  }
+  return nullptr;
+}
+
+}
+
+void Parallel::start(unsigned n){
+  if(n <= 1) return ;
+  Heap::concurrent = true;
+  threadCount = n;
+  workers = new Worker[n];
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  pthread_attr_setstacksize(&attributes, stackSize());
+  for(unsigned i = 1; i < n; ++i){
+    pthread_t thread;
+    if(pthread_create(&thread, &attributes, loop, reinterpret_cast<void *>(intptr_t(i))) != 0){
+      cerr << "[Parallel] Cannot start thread " << i << endl;
+      exit(1);
+    }
+  }
+  pthread_attr_destroy(&attributes);
+}
+
+unsigned Parallel::threads(){
+  return threadCount;
+}
+
+int Parallel::self(){
+  return index;
+}
+
+void Parallel::spark(const Context& env){
+  if(threadCount == 1) return ;
+  Worker& own = workers[index];
+  {
+    lock_guard<mutex> lock(own.lock);
+    if(own.sparks.size() >= MaxSparks) return ;
+    own.sparks.push_back(env);
+  }
+  ++pending;
+  if(sleeping > 0){
+    lock_guard<mutex> lock(gate);
+    work.notify_one();
+  }
+}
+
+void Parallel::cancel(const Context& env){
+  if(threadCount == 1) return ;
+  Worker& own = workers[index];
+  lock_guard<mutex> lock(own.lock);
+  if(!own.sparks.empty() && &own.sparks.back()[0] == &env[0]){
+    own.sparks.pop_back();
+    --pending;
+  }
+}
+
+void Parallel::fizzle(){
+  if(index == 0) return ;
+  releaseThunks();
+  throw Fizzle();
+}
+
+bool Parallel::pause(){
+  lock_guard<mutex> lock(gate);
+  if(running > 0) return false;
+  paused = true;
+  return true;
+}
+
+void Parallel::resume(){
+  lock_guard<mutex> lock(gate);
+  paused = false;
+  work.notify_all();
+}
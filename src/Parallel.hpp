@@ -0,0 +1,43 @@
+#ifndef __ULC_PARALLEL_HPP__
+#define __ULC_PARALLEL_HPP__
+
+#include "Runtime.hpp"
+
+// Work-stealing pool of evaluator threads.
+//
+// A spark is the thunk in the top frame of a context, which an idle thread
+// may evaluate to weak head normal form before it is demanded. Each thread
+// pushes its sparks to the bottom of its own deque and takes them back
+// from there, idle threads steal from the top of the others' deques.
+// Nothing waits for a spark: whoever demands the thunk first evaluates
+// it, and a thread finding it taken waits on its black hole instead.
+//
+// Collections only happen on the main thread, between sparks. An error in
+// a spark makes it fizzle, the error is left to whoever demands its thunk.
+namespace Parallel{
+
+// Thrown in place of an error on the threads evaluating sparks
+struct Fizzle{};
+
+// Run with `n` threads in all, the calling one included. To be called
+// before anything is evaluated, 1 keeps everything on the calling thread.
+void start(unsigned n);
+unsigned threads();
+// Index of the calling thread, 0 for the one that called `start`
+int self();
+
+void spark(const Context& env);
+// Take back the last spark of the calling thread if it is `env` and no
+// other thread stole it
+void cancel(const Context& env);
+// Called before reporting an error of the program: on a thread evaluating
+// a spark, gives back the thunks it entered and throws Fizzle
+void fizzle();
+
+// Keep the other threads off the heap, false if some are evaluating
+bool pause();
+void resume();
+
+}
+
+#endif
@@ -2,205 +2,266 @@
 #define __SILVERNEGI_PARSERS_HPP__
 
 #include <cstdlib>
-#include <iostream>
+#include <cstdint>
 #include <string>
-#include <algorithm>
 #include <functional>
 #include <cctype>
 
+// Parser combinators as expression templates: each combinator is a type of
+// its own holding its operands by value, so a grammar is a single object
+// whose parsing the compiler inlines into plain loops.
+//
+// A parser is called with the current position and the end of the input.
+// It returns whether it matched, moving the position past what it read if
+// it did and leaving it alone if it did not.
 namespace Parsers{
 
-// Let us not pollute the namespace outside
-using namespace std;
+using Iterator = const char *;
 
-class Parser{
+template<class P, class F> class Action;
+
+// Every parser derives from Combinator<itself>, the operators below only
+// take parsers and know their exact type through it
+template<class P>
+class Combinator{
   public:
-    using Iterator = std::string::const_iterator;
-    using ParserFunction = std::function<std::tuple<bool, Iterator> (Iterator, Iterator)>;
+    const P& self() const { return static_cast<const P&>(*this);}
 
-    ParserFunction runParser;
+    // Bind action to parser, it gets the range parsed
+    template<class F>
+    Action<P, F> operator [] (F f) const { return Action<P, F>(self(), f);}
+};
 
-    Parser();
-    Parser(ParserFunction parser) : runParser(parser) {}
-    Parser(const Parser & parser) : runParser(parser.runParser) {}
-    Parser(char);
+template<class P, class F>
+class Action : public Combinator<Action<P, F>>{
+    P parser;
+    F f;
+  public:
+    Action(const P& p, F g) : parser(p), f(g) {}
+    bool operator () (Iterator& first, Iterator last) const {
+      Iterator start = first;
+      if(! parser(first, last)) return false;
+      f(start, first);
+      return true;
+    }
+};
 
-    // Bind action to parser
-    Parser operator [] (std::function<void (const std::string&)>) const;
+// Always matches, reading nothing
+class Nothing : public Combinator<Nothing>{
+  public:
+    bool operator () (Iterator&, Iterator) const { return true;}
+};
 
+template<class F>
+class Satisfy : public Combinator<Satisfy<F>>{
+    F f;
+  public:
+    explicit Satisfy(F g) : f(g) {}
+    bool operator () (Iterator& first, Iterator last) const {
+      if(first == last || ! f(*first)) return false;
+      ++first;
+      return true;
+    }
 };
 
-// tuple<bool, Iterator>
-// <Parse state, moved position>
-std::tuple<bool, Parser::Iterator> badParse(Parser::Iterator it){
-  return std::make_tuple(false, it);
-}
+class Char : public Combinator<Char>{
+    char c;
+  public:
+    explicit Char(char x) : c(x) {}
+    bool operator () (Iterator& first, Iterator last) const {
+      if(first == last || *first != c) return false;
+      ++first;
+      return true;
+    }
+};
 
-std::tuple<bool, Parser::Iterator> goodParse(Parser::Iterator it){
-  return std::make_tuple(true, it);
-}
+// A character in `sig`, or out of it if `Member` is false
+template<bool Member>
+class Among : public Combinator<Among<Member>>{
+    // One bit per byte value
+    uint64_t bits[4];
+  public:
+    explicit Among(const std::string& sig) : bits() {
+      for(unsigned char c : sig)
+        bits[c >> 6] |= uint64_t(1) << (c & 63);
+    }
+    bool operator () (Iterator& first, Iterator last) const {
+      if(first == last) return false;
+      unsigned char c = *first;
+      if(((bits[c >> 6] >> (c & 63)) & 1) != Member) return false;
+      ++first;
+      return true;
+    }
+};
 
-Parser::Parser() : runParser( [](Parser::Iterator _, Parser::Iterator __){
-  return goodParse(_);}) {
-}
+class Word : public Combinator<Word>{
+    std::string str;
+  public:
+    explicit Word(const std::string& s) : str(s) {}
+    bool operator () (Iterator& first, Iterator last) const {
+      if(static_cast<size_t>(last - first) < str.size() || str.compare(0, str.size(), first, str.size()) != 0)
+        return false;
+      first += str.size();
+      return true;
+    }
+};
 
-Parser Parser::operator [] (function<void (const std::string&)> f) const {
-  auto parser = this->runParser;
-  return Parser([f, parser](Parser::Iterator first, Parser::Iterator last){
-    bool good;
-    Parser::Iterator second;
-    std::tie(good, second) = parser(first, last);
-    if(! good) return badParse(second);
-    f({first, second});
-    return goodParse(second);
-  });
-}
+// Zero or more.
+template<class P>
+class Many : public Combinator<Many<P>>{
+    P parser;
+  public:
+    explicit Many(const P& p) : parser(p) {}
+    bool operator () (Iterator& first, Iterator last) const {
+      while(parser(first, last)) ;
+      return true;
+    }
+};
 
-// Parser combinators
-Parser some(Parser);
-Parser many(Parser);
-Parser operator * (Parser);
-Parser operator + (Parser);
-Parser satisfy(std::function<bool (char)>);
-Parser charp(char);
-Parser word(const std::string&);
-Parser oneOf(const std::string&);
-Parser noneOf(const std::string&);
-Parser operator >> (Parser, Parser);
-Parser operator | (Parser, Parser);
-Parser say(const std::string&, std::function<void (const std::string&)>);
-Parser maybe(Parser);
-
-const Parser nothing([](Parser::Iterator _, Parser::Iterator __){
-  return goodParse(_);
-});
-
-Parser maybe(Parser parser){
-  return (parser | nothing);
-}
+// One or more.
+template<class P>
+class Some : public Combinator<Some<P>>{
+    P parser;
+  public:
+    explicit Some(const P& p) : parser(p) {}
+    bool operator () (Iterator& first, Iterator last) const {
+      if(! parser(first, last)) return false;
+      while(parser(first, last)) ;
+      return true;
+    }
+};
 
-Parser::Parser(char c) : Parser(charp(c)) {
-}
+// Monadic bind :P
+template<class F, class G>
+class Sequence : public Combinator<Sequence<F, G>>{
+    F f;
+    G g;
+  public:
+    Sequence(const F& p, const G& q) : f(p), g(q) {}
+    bool operator () (Iterator& first, Iterator last) const {
+      Iterator start = first;
+      if(f(first, last) && g(first, last)) return true;
+      first = start;
+      return false;
+    }
+};
+
+// Use `f` to parse, if fail, use `g` to parse
+template<class F, class G>
+class Choice : public Combinator<Choice<F, G>>{
+    F f;
+    G g;
+  public:
+    Choice(const F& p, const G& q) : f(p), g(q) {}
+    bool operator () (Iterator& first, Iterator last) const {
+      return f(first, last) || g(first, last);
+    }
+};
+
+template<class F>
+class Say : public Combinator<Say<F>>{
+    std::string msg;
+    F f;
+  public:
+    Say(const std::string& m, F g) : msg(m), f(g) {}
+    bool operator () (Iterator&, Iterator) const {
+      f(msg);
+      return true;
+    }
+};
 
-Parser say(const std::string& msg, std::function<void (const std::string&)> f){
-  return Parser([msg, f](Parser::Iterator _, Parser::Iterator __){
-    f(msg);
-    return goodParse(_);
-  });
+// Type-erased parser, for grammars built at run time or stored in a
+// variable of a fixed type. Every call goes through a std::function.
+class Parser : public Combinator<Parser>{
+  public:
+    using ParserFunction = std::function<bool (Iterator&, Iterator)>;
+
+    ParserFunction runParser;
+
+    Parser() : runParser(Nothing()) {}
+    template<class P>
+    Parser(const Combinator<P>& parser) : runParser(parser.self()) {}
+
+    bool operator () (Iterator& first, Iterator last) const {
+      return runParser(first, last);
+    }
+};
+
+// Parser combinators
+template<class P>
+Some<P> some(const Combinator<P>& parser){
+  return Some<P>(parser.self());
 }
 
-Parser word(const std::string& str){
-  Parser accu;
-  for(char c : str)
-    accu = accu >> charp(c);
-  return accu;
+template<class P>
+Many<P> many(const Combinator<P>& parser){
+  return Many<P>(parser.self());
 }
 
-Parser operator * (Parser parser){
+template<class P>
+Many<P> operator * (const Combinator<P>& parser){
   return many(parser);
 }
 
-Parser operator + (Parser parser){
+template<class P>
+Some<P> operator + (const Combinator<P>& parser){
   return some(parser);
 }
 
-// One or more.
-Parser some(Parser parser){
-  return Parser([parser](Parser::Iterator first, Parser::Iterator last){
-    bool good;
-    std::tie(good, first) = parser.runParser(first, last);
-    if(! good) return badParse(first);
-    std::tie(ignore, first) = many(parser).runParser(first, last);
-    return goodParse(first);
-  });
+template<class F, class G>
+Sequence<F, G> operator >> (const Combinator<F>& f, const Combinator<G>& g){
+  return Sequence<F, G>(f.self(), g.self());
 }
 
-// Zero or more.
-Parser many(Parser parser){
-  return Parser([parser](Parser::Iterator first, Parser::Iterator last){
-    bool good = true;
-    Parser::Iterator second = first;
-    while(good){
-      std::tie(good, second) = parser.runParser(first, last);
-      swap(first, second);
-    }
-    return goodParse(second);
-  });
+template<class F, class G>
+Choice<F, G> operator | (const Combinator<F>& f, const Combinator<G>& g){
+  return Choice<F, G>(f.self(), g.self());
 }
 
-// Monadic bind :P
-Parser operator >> (Parser f, Parser g){
-  return Parser([f, g](Parser::Iterator first, Parser::Iterator last){
-    bool good;
-    std::tie(good, first) = f.runParser(first, last);
-    if(! good) return badParse(first);
-    std::tie(good, first) = g.runParser(first, last);
-    if(! good) return badParse(first);
-    return goodParse(first);
-  });
+template<class P>
+Choice<P, Nothing> maybe(const Combinator<P>& parser){
+  return (parser | Nothing());
 }
 
-// Use `f` to parse, if fail, use `g` to parse
-Parser operator | (Parser f, Parser g){
-  return Parser([f, g](Parser::Iterator first, Parser::Iterator last){
-    bool good;
-    Parser::Iterator _first;
-    std::tie(good, _first) = f.runParser(first, last);
-    if(good) return goodParse(_first);
-    std::tie(good, first) = g.runParser(first, last);
-    if(good) return goodParse(first);
-    return badParse(first);
-  });
+template<class F>
+Satisfy<F> satisfy(F f){
+  return Satisfy<F>(f);
 }
 
-Parser charp(char c){
-  return satisfy([c](char x){ return c == x;});
+template<class F>
+Say<F> say(const std::string& msg, F f){
+  return Say<F>(msg, f);
 }
 
-Parser oneOf(const std::string& sig){
-  return Parser([sig](Parser::Iterator first, Parser::Iterator last){
-    if(first == last) return badParse(first);
-    if(find(sig.begin(), sig.end(), *first) == sig.end())
-      return badParse(first);
-    return goodParse(++first);
-  });
+inline Char charp(char c){
+  return Char(c);
 }
 
-Parser noneOf(const std::string& sig){
-  return Parser([sig](Parser::Iterator first, Parser::Iterator last){
-    if(first == last) return badParse(first);
-    if(find(sig.begin(), sig.end(), *first) != sig.end())
-      return badParse(first);
-    return goodParse(++first);
-  });
+inline Word word(const std::string& str){
+  return Word(str);
 }
 
-Parser satisfy(std::function<bool (char)> f){
-  return Parser([f](Parser::Iterator first, Parser::Iterator last){
-    if(first == last) return badParse(first);
-    if(! f( *first )) return badParse(first);
-    return goodParse(++first);
-  });
+inline Among<true> oneOf(const std::string& sig){
+  return Among<true>(sig);
 }
 
-const Parser letter(satisfy([](char c){
-  return isalpha(c);
-}));
-
-const Parser digit(satisfy([](char c){
-  return isdigit(c);
-}));
+inline Among<false> noneOf(const std::string& sig){
+  return Among<false>(sig);
+}
 
-const Parser alphanum(satisfy([](char c){
-  return isalnum(c);
-}));
+struct IsLetter{ bool operator () (char c) const { return isalpha(static_cast<unsigned char>(c));}};
+struct IsDigit{ bool operator () (char c) const { return isdigit(static_cast<unsigned char>(c));}};
+struct IsAlphanum{ bool operator () (char c) const { return isalnum(static_cast<unsigned char>(c));}};
+struct IsAny{ bool operator () (char) const { return true;}};
 
-const Parser anyChar(satisfy([](char c){
-  return true;
-}));
+const Nothing nothing = Nothing();
+const Satisfy<IsLetter> letter{IsLetter()};
+const Satisfy<IsDigit> digit{IsDigit()};
+const Satisfy<IsAlphanum> alphanum{IsAlphanum()};
+const Satisfy<IsAny> anyChar{IsAny()};
 
-const Parser space(oneOf(" \t\n"));
-const Parser spaces(*space);
+const Among<true> space(" \t\n");
+const Many<Among<true>> spaces(space);
 
 // end of namespace "Parsers"
 }
@@ -0,0 +1,549 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "Runtime.hpp"
+#include "Dictionary.hpp"
+#include "Collector.hpp"
+#include "Machine.hpp"
+#include "Bytecode.hpp"
+#include "Net.hpp"
+#include "Graph.hpp"
+#include "Parallel.hpp"
+#include "Stats.hpp"
+#include "Governor.hpp"
+
+using namespace std;
+
+namespace{
+
+Engine engine = Engine::Recursive;
+
+}
+
+void setEngine(Engine e){
+  engine = e;
+}
+
+void Object::root(){
+  LiveList<Object>::local().link(this);
+}
+
+void Object::unroot(){
+  if(list) list->unlink(this);
+}
+
+Object& Object::operator = (const Object& obj){
+  // `obj` may live in a frame only reachable through our own environment,
+  // so the environment is replaced last.
+  _type = obj._type;
+  _expr = obj._expr;
+  _native = obj._native;
+  _applied = obj._applied;
+  _env = obj._env;
+  return *this;
+}
+
+void Object::publish(const Object& obj){
+  _expr = obj._expr;
+  _native = obj._native;
+  _applied = obj._applied;
+  _env = obj._env;
+  __atomic_store_n(&_type, obj._type, __ATOMIC_RELEASE);
+}
+
+Context::Frame::Frame(const Object& v, const Ref<Frame>& n) : value(v), next(n), name(), internalRefs(0), marked(false) {
+  // The collector reaches `value` through this frame
+  value.unroot();
+  LiveList<Frame>::local().link(this);
+}
+
+Context::Frame::~Frame(){
+  list->unlink(this);
+}
+
+// Rewrite bound variables into de Bruijn indices.
+// `scope` maps a bound name to the depth of its binder.
+// Expressions read from JSON can be arbitrarily deep, so this keeps its
+// own stack.
+void resolve(Expression& root, const Dictionary<int, Symbol>& rootScope, int rootDepth){
+  struct Pending{
+    Expression * expr;
+    Dictionary<int, Symbol> scope;
+    int depth;
+  };
+  vector<Pending> stack(1, Pending{&root, rootScope, rootDepth});
+  while(!stack.empty()){
+    Pending top = stack.back();
+    stack.pop_back();
+    Expression& expr = *top.expr;
+    switch(expr.type){
+      case Expression::Var:
+        expr.index = top.scope.exist(expr.name) ? top.depth - top.scope[expr.name] - 1 : -1;
+        break;
+      case Expression::Lambda:
+        stack.push_back(Pending{&Expression::at(expr.body), top.scope.insert(expr.name, top.depth), top.depth + 1});
+        break;
+      case Expression::Ap:
+        stack.push_back(Pending{&Expression::at(expr.arg), top.scope, top.depth});
+        stack.push_back(Pending{&Expression::at(expr.body), top.scope, top.depth});
+        break;
+      case Expression::Constant:
+      case Expression::Nothing:
+        break;
+    }
+  }
+}
+
+Expression::Ref copyExpression(const Expression& expr){
+  Expression res(expr);
+  if(expr.isLam() || expr.isAp())
+    res.body = copyExpression(Expression::at(expr.body));
+  if(expr.isAp())
+    res.arg = copyExpression(Expression::at(expr.arg));
+  return Expression::make(res);
+}
+
+Context& Context::add(const string& name, const string& rule) {
+  Scanner scanner(rule);
+  Expression& expr = Expression::at(parseExpression(scanner));
+  resolve(expr);
+  return add(name, Object(expr, *this));
+}
+
+Context& Context::add(const string& name, const Object& rule){
+  *this = insert(rule);
+  _frames->name = intern(name);
+  return *this;
+}
+
+Context Context::insert(const Object& obj) const {
+  Collector::poll();
+  return Ref<Frame>::make(obj, _frames);
+}
+
+Object& Context::lookup(const string& str) const {
+  Symbol name = intern(str);
+  for(Frame * frame = _frames.get(); frame; frame = frame->next.get()){
+    if(frame->name == name)
+      return frame->value;
+  }
+  cerr << "[Context lookup] Unexpected free variable: " << str << endl;
+  exit(1);
+}
+
+Object& Context::operator [] (int index) const {
+  Frame * frame = _frames.get();
+  while(index--)
+    frame = frame->next.get();
+  return frame->value;
+}
+
+Context Context::drop(int n) const {
+  Frame * frame = _frames.get();
+  while(n--)
+    frame = frame->next.get();
+  return Ref<Frame>(frame);
+}
+
+Symbol Context::name(int index) const {
+  Frame * frame = _frames.get();
+  while(index--)
+    frame = frame->next.get();
+  return frame->name;
+}
+
+void Context::resolve(Expression& expr, const vector<Symbol>& binders) const {
+  int depth = 0;
+  for(Frame * frame = _frames.get(); frame; frame = frame->next.get())
+    ++depth;
+  Dictionary<int, Symbol> scope;
+  int level = depth;
+  for(Frame * frame = _frames.get(); frame; frame = frame->next.get()){
+    --level;
+    if(frame->name && !scope.exist(frame->name))
+      scope = scope.insert(frame->name, level);
+  }
+  for(Symbol name : binders)
+    scope = scope.insert(name, depth++);
+  ::resolve(expr, scope, depth);
+}
+
+bool Object::callable() const {
+  if(type() == Primitive){
+    return true;
+  }else{
+    if(_expr.isLam()){
+      return true;
+    }else{
+      return false;
+    }
+  }
+}
+
+size_t reductions = 0;
+
+Object Object::call(const Expression& expr, const Context& env, int more) const {
+  if(type() == Primitive){
+    Object arg(expr, env);
+    if(missing() == 1)
+      return saturate(&arg);
+    // Collect the argument until the primitive has all of them
+    Object partial(*this);
+    partial._applied += 1;
+    partial._env = _env.insert(arg);
+    return partial;
+  }else{
+    if(_expr.isLam()){
+      // The body would evaluate the argument, do it now rather than make
+      // a thunk of it
+      int strict = demands();
+      if(strict && more >= 0 && strict - 1 <= more)
+        return bind(weakNormalForm(expr, env));
+      Governor::step();
+      STATS(Stats::beta(&_expr));
+      if(isNormalForm()){
+        // A normal form is read back with named variables, bind them again
+        Context env2 = Context().insert(Object(expr, env));
+        Expression lam(_expr);
+        lam.body = copyExpression(Expression::at(_expr.body));
+        ::resolve(lam, Dictionary<int, Symbol>(), 0);
+        return Object(Expression::at(lam.body), env2);
+      }
+      return Object(Expression::at(_expr.body), _env.insert(Object(expr, env)));
+    }else{
+      Parallel::fizzle();
+      cerr << "[Object call] Object not callable (not a `Lambda`): " << (int)_expr.type << endl;
+      Governor::stop(Governor::Failure);
+    }
+  }
+}
+
+Object Object::bind(const Object& value) const {
+  Governor::step();
+  STATS(Stats::beta(&_expr));
+  return Object(Expression::at(_expr.body), _env.insert(value));
+}
+
+int Object::demands() const {
+  return type() == Closure && _expr.isLam() && _expr.strict > 0 ? _expr.strict : 0;
+}
+
+Object Object::saturate(const Object * args) const {
+  Governor::step();
+  STATS(Stats::primitive(*_native));
+  if(_applied == 0)
+    return _native->code(args);
+  // Put the arguments collected by `call` below the others
+  vector<Object> all(args, args + missing());
+  for(int i = 0; i < _applied; ++i)
+    all.push_back(_env[i]);
+  return _native->code(all.data());
+}
+
+Object makeNormalForm(const Expression& expr){
+  return Object(Object::NormalForm, expr);
+}
+
+namespace{
+
+// Thunks shared between threads are entered and updated under the lock of
+// their stripe, threads wait there for the black holes of the others.
+const size_t Stripes = 64;
+mutex stripeLocks[Stripes];
+condition_variable stripeUpdates[Stripes];
+unsigned stripeWaiters[Stripes];
+// The thunks a thread evaluating a spark entered and has not updated yet,
+// with what they held
+thread_local vector<pair<Object *, Object>> entered;
+
+size_t stripe(const Object& slot){
+  return (reinterpret_cast<uintptr_t>(&slot) >> 4) % Stripes;
+}
+
+}
+
+Object enterThunk(Object& slot){
+  if(!Heap::concurrent){
+    if(slot.isBlackhole()){
+      cerr << "[Runtime] <<loop>>" << endl;
+      exit(1);
+    }
+    Object thunk(slot);
+    slot = Object(Object::Blackhole, Expression());
+    STATS(Stats::enter(thunk.expr()));
+    return thunk;
+  }
+  // A black hole records the thread evaluating it
+  size_t i = stripe(slot);
+  unique_lock<mutex> lock(stripeLocks[i]);
+  while(slot.isBlackhole()){
+    if(slot._expr.val == Parallel::self()){
+      Parallel::fizzle();
+      cerr << "[Runtime] <<loop>>" << endl;
+      Governor::stop(Governor::Failure);
+    }
+    ++stripeWaiters[i];
+    stripeUpdates[i].wait(lock);
+    --stripeWaiters[i];
+  }
+  Object thunk(slot);
+  if(thunk.isNormalForm() || thunk.isPrimitive())
+    return thunk;
+  slot.publish(Object(Object::Blackhole, Expression(Parallel::self())));
+  if(Parallel::self() != 0)
+    entered.emplace_back(&slot, thunk);
+  STATS(Stats::enter(thunk.expr()));
+  return thunk;
+}
+
+void updateThunk(Object& slot, const Object& value){
+  STATS(Stats::leave());
+  if(!Heap::concurrent){
+    slot = value;
+    return ;
+  }
+  if(Parallel::self() != 0){
+    while(!entered.empty() && entered.back().first != &slot)
+      entered.pop_back();
+    if(!entered.empty())
+      entered.pop_back();
+  }
+  size_t i = stripe(slot);
+  lock_guard<mutex> lock(stripeLocks[i]);
+  slot.publish(value);
+  if(stripeWaiters[i])
+    stripeUpdates[i].notify_all();
+}
+
+void releaseThunks(){
+  while(!entered.empty()){
+    Object& slot = *entered.back().first;
+    size_t i = stripe(slot);
+    {
+      lock_guard<mutex> lock(stripeLocks[i]);
+      slot.publish(entered.back().second);
+      if(stripeWaiters[i])
+        stripeUpdates[i].notify_all();
+    }
+    entered.pop_back();
+  }
+}
+
+namespace{
+
+// The arguments of a saturated primitive call, kept on the C++ stack
+class Arguments{
+    static const int Capacity = 4;
+    alignas(Object) char buffer[Capacity * sizeof(Object)];
+    int count;
+  public:
+    static bool fit(int n) { return n <= Capacity;}
+
+    Arguments() : count(0) {}
+    ~Arguments(){
+      while(count)
+        data()[--count].~Object();
+    }
+    void push(const Object& obj) { new (buffer + count++ * sizeof(Object)) Object(obj);}
+    const Object * data() { return reinterpret_cast<Object *>(buffer);}
+};
+
+// The application spine `ap` reduced up to its last application. The head
+// is evaluated first, then applied to the arguments innermost first; a
+// primitive is called at once on all the arguments it misses. What the
+// last application returns is left to the caller to evaluate, so that a
+// chain of calls in tail position runs in a loop rather than nesting.
+Object applySpine(const Expression& ap, const Context& env){
+  const int Inline = 8;
+  Expression::Ref inlineArgs[Inline];
+  vector<Expression::Ref> moreArgs;
+  int n = 0;
+  const Expression * head = &ap;
+  for(; head->isAp(); head = &Expression::at(head->body), ++n){
+    if(n == Inline)
+      moreArgs.assign(inlineArgs, inlineArgs + Inline);
+    if(n >= Inline)
+      moreArgs.push_back(head->arg);
+    else
+      inlineArgs[n] = head->arg;
+  }
+  // Outermost argument first
+  const Expression::Ref * args = n > Inline ? moreArgs.data() : inlineArgs;
+
+  Object value = weakNormalForm(*head, env);
+  for(int i = n - 1; i >= 0; ){
+    int k = value.missing();
+    if( k > 1 && k <= i + 1 && Arguments::fit(k) ){
+      Arguments argv;
+      for(int j = i - k + 1; j <= i; ++j)
+        argv.push(Object(Expression::at(args[j]), env));
+      i -= k;
+      Object res = value.saturate(argv.data());
+      value = res.isNormalForm() || res.isPrimitive() || i < 0 ? res : weakNormalForm(res.expr(), res.env());
+    }else if( value.callable() ){
+      // `i` more arguments follow this one
+      Object res = value.call(Expression::at(args[i]), env, i);
+      --i;
+      value = res.isNormalForm() || res.isPrimitive() || i < 0 ? res : weakNormalForm(res.expr(), res.env());
+    }else{
+      Object argNF(normalForm(Expression::at(args[i--]), env));
+      // No collection can happen from here on, the new nodes are safe
+      Expression expr2(Expression::Ap);
+      expr2.body = Expression::make(value.expr());
+      expr2.arg = Expression::make(argNF.expr());
+      value = makeNormalForm( expr2 );
+    }
+  }
+  return value;
+}
+
+// Normal form of a primitive: its name applied to the normal forms of the
+// arguments it has collected, the first one first
+Object readBack(const Object& primitive){
+  Object nf = makeNormalForm(primitive.expr());
+  for(int i = primitive.applied() - 1; i >= 0; --i){
+    const Object& arg = primitive.env()[i];
+    Object argNF = arg.isPrimitive() ? readBack(arg) : arg.isNormalForm() ? arg : normalForm(arg.expr(), arg.env());
+    Expression ap(Expression::Ap);
+    ap.body = Expression::make(nf.expr());
+    ap.arg = Expression::make(argNF.expr());
+    nf = makeNormalForm(ap);
+  }
+  return nf;
+}
+
+}
+
+Object weakNormalForm(const Expression& expr, const Context& env){
+  if( engine == Engine::Machine )
+    return Machine::evaluate(expr, env, false);
+  if( engine == Engine::Bytecode )
+    return Bytecode::evaluate(expr, env, false);
+  Governor::deep();
+  STATS(Stats::Nesting nesting);
+  switch( expr.type ){
+    case Expression::Constant:
+      return makeNormalForm( expr );
+      break;
+    case Expression::Var:
+      if( expr.index >= 0 ){
+        STATS(++Stats::lookups);
+        Object& res = env[expr.index];
+        if( res.isNormalForm() )
+          return res;
+        if( res.isPrimitive() )
+          return res;
+        Object thunk = enterThunk(res);
+        if( thunk.isNormalForm() || thunk.isPrimitive() )
+          return thunk;
+        Object value = weakNormalForm( thunk.expr(), thunk.env() );
+        updateThunk(res, value);
+        return value;
+      }else{
+        return makeNormalForm( expr );
+      }
+      break;
+    case Expression::Lambda:
+      return Object(expr, env);
+      break;
+    case Expression::Ap:
+      {
+        Object res = applySpine(expr, env);
+        // Applications in tail position, one after the other
+        while( res.type() == Object::Closure && res.expr().isAp() )
+          res = applySpine(res.expr(), res.env());
+        if( res.type() == Object::Closure && !res.expr().isLam() )
+          return weakNormalForm(res.expr(), res.env());
+        return res;
+      }
+      break;
+    case Expression::Nothing:
+      cerr << "[Weak normal form] Unexpected expression type: " << (int)expr.type << endl;
+      exit(1);
+  }
+}
+
+namespace{
+
+// One step of the normal form of `expr` in `env` on the recursive engine:
+// the normal form, or a closure whose normal form it is, left to the
+// caller so that the steps of a long chain of IO actions run in a loop
+Object normalStep(const Expression& expr, const Context& env){
+  switch( expr.type ){
+    case Expression::Constant:
+      return makeNormalForm( expr );
+      break;
+    case Expression::Var:
+      if( expr.index >= 0 ){
+        STATS(++Stats::lookups);
+        Object &res = env[expr.index];
+        if( res.isNormalForm() )
+          return res;
+        if( res.isPrimitive() )
+          return readBack(res);
+        // The frame only ever holds the weak head normal form
+        Object thunk = enterThunk(res);
+        if( thunk.isNormalForm() )
+          return thunk;
+        if( thunk.isPrimitive() )
+          return readBack(thunk);
+        Object value = weakNormalForm( thunk.expr(), thunk.env() );
+        updateThunk(res, value);
+        if( value.isNormalForm() )
+          return value;
+        if( value.isPrimitive() )
+          return readBack(value);
+        return value;
+      }else{
+        return makeNormalForm( expr );
+      }
+      break;
+    case Expression::Lambda:
+      {
+        Expression expr2(expr);
+        // The bound variable stays a free, named variable in the normal form
+        Expression var(Expression::Var);
+        var.name = expr.name;
+        Context env2 = env.insert(makeNormalForm(var));
+        expr2.body = Expression::make(normalForm(Expression::at(expr.body), env2).expr());
+        return makeNormalForm( expr2 );
+      // return Object(expr2, env);
+      }
+      break;
+    case Expression::Ap:
+      {
+        Object res = applySpine(expr, env);
+        if( res.isPrimitive() )
+          return readBack(res);
+        return res;
+      }
+      break;
+    case Expression::Nothing:
+      cerr << "[Normal form] Unexpected expression type: " << (int)expr.type << endl;
+      exit(1);
+  }
+}
+
+}
+
+Object normalForm(const Expression& expr, const Context& env){
+  if( engine == Engine::Machine )
+    return Machine::evaluate(expr, env, true);
+  if( engine == Engine::Bytecode )
+    return Bytecode::evaluate(expr, env, true);
+  if( engine == Engine::Net )
+    return Net::normalForm(expr, env);
+  if( engine == Engine::Graph )
+    return Graph::normalForm(expr, env);
+  Governor::deep();
+  STATS(Stats::Nesting nesting);
+  Object res = normalStep(expr, env);
+  while( res.type() == Object::Closure )
+    res = normalStep(res.expr(), res.env());
+  return res;
+}
+
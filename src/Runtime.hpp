@@ -0,0 +1,203 @@
+#ifndef __ULC_RUNTIME_HPP__
+#define __ULC_RUNTIME_HPP__
+
+#include <string>
+#include <vector>
+
+#include "ExpressionParser.hpp"
+#include "Heap.hpp"
+
+/* Data structures
+ *
+ * data Expression = Var | Lambda | Ap
+ *
+ * data Object  = Callable Expression
+ * data Context = Map Var/String Object
+ * normalForm :: Context -> Expression -> Object
+ * weakNormalForm :: Context -> Expression -> Object
+ *
+ * type Primitive = Var -> Expression
+ * data Object = Object Expression Context | Primitive Context
+ * data Context = [Object]  -- indexed by de Bruijn index
+ *
+ * weakNormalForm :: Object -> Object
+ * normalForm :: Object -> Object
+ *
+ * weakNormalForm / normalForm morphs a object (beta reduction)
+ *
+ */
+
+class Object;
+class Context;
+
+// A primitive taking `arity` arguments, only called once it has all of
+// them. The arguments are unevaluated closures passed as they lie on the
+// evaluators' stacks: the last one first, `args[arity - 1]` is the first.
+//
+// What the engines and the passes know of it is given with it, so that
+// none of them looks a primitive up by its name.
+struct Native{
+  // The arithmetic or comparison of its two number operands
+  enum Operation : unsigned char{None, Add, Sub, Mul, Div, Mod, Eq, Lt, Le};
+
+  const char * name;
+  int arity;
+  Operation operation;
+  // The arguments it evaluates, a bit each from the first one up
+  unsigned strict;
+  // It returns a boolean choosing between the arguments applied from this
+  // one on, -1 if it does not
+  int branches;
+  // It has an effect
+  bool effect;
+  Object (*code)(const Object * args);
+
+  // Its operands are numbers, evaluated before it is called
+  bool numeric() const { return operation != None;}
+  // It may be computed ahead of time once applied to constants
+  bool foldable() const { return operation >= Add && operation <= Mod;}
+};
+
+class Context{
+    friend class Collector;
+
+    struct Frame;
+    Ref<Frame> _frames;
+
+    Context(const Ref<Frame>& frames) : _frames(frames) {}
+  public:
+    Context() {}
+    Context(const Context& context) : _frames(context._frames) {}
+
+    Context& add(const std::string&, const std::string&);
+    Context& add(const std::string&, const Object&);
+    Context insert(const Object&) const;
+    Object& lookup(const std::string&) const;
+    Object& operator [] (int) const;
+    // The context with the innermost `n` frames removed
+    Context drop(int n) const;
+    // Both are the same frames
+    bool operator == (const Context& context) const { return _frames.get() == context._frames.get();}
+    // Name given by `add` to the binding at `index`, 0 for the others
+    Symbol name(int index) const;
+    // Resolve `expr` as if under lambdas binding `binders` in this
+    // context, the outermost first
+    void resolve(Expression& expr, const std::vector<Symbol>& binders = std::vector<Symbol>()) const;
+};
+
+class Object{
+    friend class Collector;
+  public:
+    // A closure is a thunk until it is updated with its weak head normal
+    // form, while under evaluation its slot holds a black hole instead.
+    enum Type{Primitive, Closure, NormalForm, Blackhole};
+  private:
+    Type _type;
+    Expression _expr;
+    Context _env;
+    // A primitive applied to fewer than `arity` arguments keeps them in
+    // `_env`, the last one on top, and their count in `_applied`. Its
+    // `_expr` is the name of the native, a free variable.
+    const Native * _native;
+    int _applied;
+
+    // Objects living outside of the heap are linked together, they are
+    // the roots of the collector. Null once the object lives in a frame.
+    LiveList<Object> * list;
+    Object * prevLive;
+    Object * nextLive;
+    template<class> friend class LiveList;
+
+    void root();
+    void unroot();
+    // Assign the type last, for frames read by other threads
+    void publish(const Object&);
+
+    Object(Type t, const Expression& expr) : _type(t), _expr(expr), _native(nullptr), _applied(0) { root();}
+  public:
+    Object(const Expression& expr) : _type(Closure), _expr(expr), _env(), _native(nullptr), _applied(0) { root();}
+    Object(const Expression& expr, const Context& env) : _type(Closure), _expr(expr), _env(env), _native(nullptr), _applied(0) { root();}
+    explicit Object(const Native& native) : _type(Primitive), _expr(native.name), _native(&native), _applied(0) { root();}
+    Object(const Object& obj) : _type(obj._type), _expr(obj._expr), _env(obj._env), _native(obj._native), _applied(obj._applied) { root();}
+    ~Object() { unroot();}
+
+    Object& operator = (const Object&);
+
+    const Expression& expr() const { return _expr;}
+    const Context& env() const { return _env;}
+
+    // `more` arguments are applied right after this one; a strict argument
+    // is evaluated first unless `more` is negative
+    Object call(const Expression& expr, const Context& env, int more = -1) const;
+    // Reduce a lambda closure, its variable bound to `value` as it is
+    Object bind(const Object& value) const;
+    // For a lambda closure, the arguments it needs before its body
+    // evaluates its variable, this one included; 0 if it may never
+    int demands() const;
+    // Arguments a primitive still needs to be called, 0 for other objects
+    int missing() const { return type() == Primitive ? _native->arity - _applied : 0;}
+    // Arguments a primitive has collected, in `env()` the last one on top
+    int applied() const { return _applied;}
+    // The native of a primitive, null for other objects
+    const Native * native() const { return _native;}
+    // Call a primitive with its `missing()` arguments, the last one first
+    Object saturate(const Object * args) const;
+
+    bool callable() const;
+
+    // A frame updated by another thread publishes its type last
+    Type type() const { return __atomic_load_n(&_type, __ATOMIC_ACQUIRE);}
+    bool isNormalForm() const { return type() == NormalForm;}
+    bool isPrimitive() const { return type() == Primitive;}
+    bool isBlackhole() const { return type() == Blackhole;}
+
+    friend Object makeNormalForm(const Expression&);
+    friend Object enterThunk(Object&);
+    friend void updateThunk(Object&, const Object&);
+    friend void releaseThunks();
+    friend class Context;
+};
+
+// Frames form a persistent linked list, the innermost binding on top.
+// Only the top-level bindings made by `add` keep their names, they are
+// needed to resolve the programs evaluated in this context.
+struct Context::Frame : public Cell{
+  Object value;
+  Ref<Frame> next;
+  Symbol name;
+
+  // Every frame alive is linked in the list of its thread, walked by the
+  // collector
+  LiveList<Frame> * list;
+  Frame * prevLive;
+  Frame * nextLive;
+  unsigned internalRefs;
+  bool marked;
+
+  Frame(const Object& v, const Ref<Frame>& n);
+  ~Frame();
+};
+
+Object makeNormalForm(const Expression& expr);
+// Take the thunk out of a frame to evaluate it, leaving a black hole until
+// the frame is updated. Entering a black hole is a `<<loop>>`, unless
+// another thread is evaluating it: then this waits for the update, and
+// returns the value itself if it is a normal form or a primitive.
+Object enterThunk(Object& slot);
+// Write the weak head normal form of an entered thunk back into its frame
+void updateThunk(Object& slot, const Object& value);
+// Give the thunks the calling thread entered and has not updated back to
+// their frames, as they were before
+void releaseThunks();
+Object weakNormalForm(const Expression& expr, const Context& env);
+Object normalForm(const Expression& expr, const Context& env);
+
+// Engine behind `weakNormalForm` and `normalForm`
+enum class Engine{Recursive, Machine, Bytecode, Net, Graph};
+void setEngine(Engine);
+
+// Beta reductions and calls of natives made by the engines, approximate
+// while several threads evaluate
+extern size_t reductions;
+
+#endif
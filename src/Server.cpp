@@ -0,0 +1,251 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "Server.hpp"
+
+using namespace std;
+
+namespace{
+
+// Sent first, with the three streams of the client
+struct Header{
+  uint8_t print;
+  uint8_t json;
+  int32_t optimization;
+  uint64_t fuel;
+  uint64_t heapBytes;
+  double seconds;
+  uint64_t length;
+};
+
+const int Streams = 3;
+
+// Longest program a client may send
+const uint64_t MaxLength = 64 << 20;
+
+// The request in `header`, false if a field is out of its range
+bool decode(const Header& header, Server::Request& request){
+  if(header.print > 1 || header.json > 1 || header.optimization < 0 || header.optimization > 9
+      || !(header.seconds >= 0) || !std::isfinite(header.seconds) || header.length > MaxLength)
+    return false;
+  request.print = header.print;
+  request.json = header.json;
+  request.optimization = header.optimization;
+  request.limits.fuel = header.fuel;
+  request.limits.heapBytes = header.heapBytes;
+  request.limits.seconds = header.seconds;
+  return true;
+}
+
+sockaddr_un address(const char * path){
+  sockaddr_un address;
+  memset(&address, 0, sizeof address);
+  address.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof address.sun_path){
+    cerr << "[Server] Socket path too long: " << path << endl;
+    exit(1);
+  }
+  strcpy(address.sun_path, path);
+  return address;
+}
+
+bool readAll(int fd, char * data, size_t length){
+  while(length > 0){
+    ssize_t n = read(fd, data, length);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool writeAll(int fd, const char * data, size_t length){
+  while(length > 0){
+    ssize_t n = write(fd, data, length);
+    if(n < 0 && errno == EINTR) continue;
+    if(n < 0) return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+// The tighter of two limits, 0 being none
+template<class T>
+T tighter(T a, T b){
+  return a == 0 || (b != 0 && b < a) ? b : a;
+}
+
+// The header of a request and the streams passed with it, false if the
+// client sent something else
+bool receive(int client, Header& header, int * streams){
+  char control[CMSG_SPACE(Streams * sizeof(int))];
+  iovec data = {&header, sizeof header};
+  msghdr message;
+  memset(&message, 0, sizeof message);
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof control;
+  ssize_t n;
+  do{
+    n = recvmsg(client, &message, 0);
+  }while(n < 0 && errno == EINTR);
+  if(n <= 0) return false;
+  cmsghdr * passed = CMSG_FIRSTHDR(&message);
+  if((message.msg_flags & MSG_CTRUNC) || !passed || passed->cmsg_level != SOL_SOCKET
+      || passed->cmsg_type != SCM_RIGHTS || passed->cmsg_len != CMSG_LEN(Streams * sizeof(int)))
+    return false;
+  memcpy(streams, CMSG_DATA(passed), Streams * sizeof(int));
+  // The rest of a header split on the way
+  if(!readAll(client, reinterpret_cast<char *>(&header) + n, sizeof header - n)){
+    for(int i = 0; i < Streams; ++i)
+      close(streams[i]);
+    return false;
+  }
+  return true;
+}
+
+// Evaluate the request of `client` in a child, and send back its status.
+// True in the child.
+bool handle(int client, const Governor::Limits& limits, Server::Request& request, string& program){
+  Header header;
+  int streams[Streams];
+  if(!receive(client, header, streams)) return false;
+  int32_t status = 1;
+  if(!decode(header, request)){
+    const char message[] = "[Server] Bad request\n";
+    writeAll(streams[2], message, sizeof message - 1);
+    for(int i = 0; i < Streams; ++i)
+      close(streams[i]);
+    writeAll(client, reinterpret_cast<const char *>(&status), sizeof status);
+    return false;
+  }
+  program.resize(header.length);
+  if(!readAll(client, &program[0], program.size())){
+    for(int i = 0; i < Streams; ++i)
+      close(streams[i]);
+    return false;
+  }
+  pid_t pid = fork();
+  if(pid == 0){
+    for(int i = 0; i < Streams; ++i){
+      dup2(streams[i], i);
+      close(streams[i]);
+    }
+    close(client);
+    request.limits.fuel = tighter(request.limits.fuel, limits.fuel);
+    request.limits.heapBytes = tighter(request.limits.heapBytes, limits.heapBytes);
+    request.limits.seconds = tighter(request.limits.seconds, limits.seconds);
+    return true;
+  }
+  for(int i = 0; i < Streams; ++i)
+    close(streams[i]);
+  int code;
+  if(pid > 0 && waitpid(pid, &code, 0) == pid)
+    status = WIFEXITED(code) ? WEXITSTATUS(code) : 128 + WTERMSIG(code);
+  writeAll(client, reinterpret_cast<const char *>(&status), sizeof status);
+  return false;
+}
+
+}
+
+void Server::serve(const char * path, const Governor::Limits& limits, Request& request, string& program){
+  sockaddr_un local = address(path);
+  // A socket left by an earlier server is replaced, nothing else is
+  struct stat status;
+  if(lstat(path, &status) == 0){
+    if(!S_ISSOCK(status.st_mode)){
+      cerr << "[Server] Not a socket, left in place: " << path << endl;
+      exit(1);
+    }
+    unlink(path);
+  }
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&local), sizeof local) < 0 || listen(listener, 64) < 0){
+    cerr << "[Server] Cannot listen on " << path << endl;
+    exit(1);
+  }
+  // The processes handling the requests are reaped by the system
+  signal(SIGCHLD, SIG_IGN);
+  while(true){
+    int client = accept(listener, nullptr, nullptr);
+    if(client < 0) continue;
+    pid_t pid = fork();
+    if(pid == 0){
+      close(listener);
+      signal(SIGCHLD, SIG_DFL);
+      // A client gone before its status only loses the status
+      signal(SIGPIPE, SIG_IGN);
+      if(handle(client, limits, request, program)){
+        signal(SIGPIPE, SIG_DFL);
+        return;
+      }
+      _exit(0);
+    }
+    close(client);
+  }
+}
+
+int Server::submit(const char * path, const Request& request, const string& program){
+  sockaddr_un remote = address(path);
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(server < 0 || connect(server, reinterpret_cast<sockaddr *>(&remote), sizeof remote) < 0){
+    cerr << "[Server] Cannot connect to " << path << endl;
+    exit(1);
+  }
+  if(program.size() > MaxLength){
+    cerr << "[Server] Program too long: " << program.size() << " bytes" << endl;
+    exit(1);
+  }
+  Header header;
+  memset(&header, 0, sizeof header);
+  header.print = request.print;
+  header.json = request.json;
+  header.optimization = request.optimization;
+  header.fuel = request.limits.fuel;
+  header.heapBytes = request.limits.heapBytes;
+  header.seconds = request.limits.seconds;
+  header.length = program.size();
+  int streams[Streams] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  char control[CMSG_SPACE(sizeof streams)];
+  memset(control, 0, sizeof control);
+  iovec data = {&header, sizeof header};
+  msghdr message;
+  memset(&message, 0, sizeof message);
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof control;
+  cmsghdr * passed = CMSG_FIRSTHDR(&message);
+  passed->cmsg_level = SOL_SOCKET;
+  passed->cmsg_type = SCM_RIGHTS;
+  passed->cmsg_len = CMSG_LEN(sizeof streams);
+  memcpy(CMSG_DATA(passed), streams, sizeof streams);
+  ssize_t n;
+  do{
+    n = sendmsg(server, &message, 0);
+  }while(n < 0 && errno == EINTR);
+  int32_t status;
+  if(n < 0
+      || !writeAll(server, reinterpret_cast<const char *>(&header) + n, sizeof header - n)
+      || !writeAll(server, program.data(), program.size())
+      || !readAll(server, reinterpret_cast<char *>(&status), sizeof status)){
+    cerr << "[Server] The server dropped the request" << endl;
+    exit(1);
+  }
+  close(server);
+  return status;
+}
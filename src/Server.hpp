@@ -0,0 +1,40 @@
+#ifndef __ULC_SERVER_HPP__
+#define __ULC_SERVER_HPP__
+
+#include <string>
+
+#include "Governor.hpp"
+
+// Evaluation of programs sent over a Unix socket to a server holding the
+// prelude already built.
+//
+// A client connects, passes its standard input, output and error along
+// with the request, then sends its program and waits for the exit status
+// of the evaluation. The server forks a process for each request, so that
+// every evaluation starts from the same prelude, reads and writes the
+// streams of its client, and stops on its own errors and limits without
+// taking the server down. The limits of the server bound those of every
+// request, and a request out of range is refused with status 1.
+namespace Server{
+
+// What a client asks for, besides its program
+struct Request{
+  // Print the normal form, as JSON if `json`
+  bool print;
+  bool json;
+  int optimization;
+  Governor::Limits limits;
+};
+
+// Serve requests on the socket at `path`, forever. Only returns in the
+// process forked to evaluate a request, with its `request` and `program`
+// read and the streams of its client in place of its own.
+void serve(const char * path, const Governor::Limits& limits, Request& request, std::string& program);
+
+// Have the server at `path` evaluate `program` with the streams of this
+// process, return the exit status of the evaluation
+int submit(const char * path, const Request& request, const std::string& program);
+
+}
+
+#endif
@@ -0,0 +1,259 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Snapshot.hpp"
+
+using namespace std;
+
+// A snapshot is, in the byte order of the machine that made it:
+//   a Header;
+//   the names of the symbols, each ended by a 0, padded to 4 bytes;
+//   the expressions as Records, children before their parents;
+//   the rules, then the hole's binders.
+// Expressions refer to each other by their index in the records from 1,
+// symbols by their index in the names from 1. 0 stands for none of either.
+namespace{
+
+const char Magic[8] = {'U', 'L', 'C', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t Version = 1;
+
+// Stands for the program while the prelude is parsed
+const char * const placeholder = "<program>";
+
+struct Header{
+  char magic[8];
+  uint32_t version;
+  uint32_t symbolBytes;
+  uint32_t symbols;
+  uint32_t records;
+  uint32_t rules;
+  uint32_t binders;
+  uint32_t file;
+  uint32_t hole;
+  uint64_t key;
+};
+
+struct Record{
+  uint32_t type;
+  int32_t val;
+  uint32_t name;
+  uint32_t body;
+  uint32_t arg;
+};
+
+size_t padded(size_t bytes){
+  return (bytes + 3) & ~size_t(3);
+}
+
+// Look for the variable named `name` under `ref`, recording the names of
+// the lambdas on the way. `alone` tells if `ref` is the whole prelude or
+// the body of a lambda, so that the program parsed alone would take its
+// place.
+bool find(Expression::Ref ref, Symbol name, bool alone, Snapshot::Image& image, bool& whole){
+  const Expression& expr = Expression::at(ref);
+  switch(expr.type){
+    case Expression::Var:
+      if(expr.name != name) return false;
+      image.hole = ref;
+      whole = alone;
+      return true;
+    case Expression::Lambda:
+      image.binders.push_back(expr.name);
+      if(find(expr.body, name, true, image, whole)) return true;
+      image.binders.pop_back();
+      return false;
+    case Expression::Ap:
+      return find(expr.body, name, false, image, whole) || find(expr.arg, name, false, image, whole);
+    default:
+      return false;
+  }
+}
+
+class Writer{
+    unordered_map<Symbol, uint32_t> symbolIndex;
+    unordered_map<Expression::Ref, uint32_t> recordIndex;
+  public:
+    string names;
+    vector<Record> records;
+
+    uint32_t symbol(Symbol sym){
+      if(!sym) return 0;
+      auto it = symbolIndex.find(sym);
+      if(it != symbolIndex.end()) return it->second;
+      names += symbolName(sym);
+      names += '\0';
+      uint32_t index = symbolIndex.size() + 1;
+      symbolIndex[sym] = index;
+      return index;
+    }
+
+    uint32_t record(Expression::Ref ref){
+      if(ref == Expression::null) return 0;
+      auto it = recordIndex.find(ref);
+      if(it != recordIndex.end()) return it->second;
+      const Expression& expr = Expression::at(ref);
+      Record rec{expr.type, expr.val, symbol(expr.name), 0, 0};
+      if(expr.isLam() || expr.isAp()) rec.body = record(expr.body);
+      if(expr.isAp()) rec.arg = record(expr.arg);
+      records.push_back(rec);
+      recordIndex[ref] = records.size();
+      return records.size();
+    }
+
+    uint32_t symbolCount() const { return symbolIndex.size();}
+};
+
+template<class T>
+void append(string& out, const T * data, size_t count){
+  out.append(reinterpret_cast<const char *>(data), sizeof(T) * count);
+}
+
+bool read(const char * data, size_t size, uint64_t key, Snapshot::Image& image){
+  Header header;
+  if(size < sizeof(Header)) return false;
+  memcpy(&header, data, sizeof(Header));
+  if(memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version || header.key != key)
+    return false;
+  size_t recordsAt = padded(sizeof(Header) + size_t(header.symbolBytes));
+  size_t rulesAt = recordsAt + sizeof(Record) * size_t(header.records);
+  if(size != rulesAt + sizeof(uint32_t) * (size_t(header.rules) + header.binders))
+    return false;
+
+  vector<Symbol> symbols(1, 0);
+  const char * name = data + sizeof(Header), * namesEnd = name + header.symbolBytes;
+  while(name != namesEnd){
+    const char * end = static_cast<const char *>(memchr(name, '\0', namesEnd - name));
+    if(!end) return false;
+    symbols.push_back(intern(string(name, end)));
+    name = end + 1;
+  }
+  if(symbols.size() != header.symbols + 1) return false;
+
+  // Children come first, they are made by the time their parent is
+  const Record * records = reinterpret_cast<const Record *>(data + recordsAt);
+  vector<Expression::Ref> refs(header.records + 1, Expression::null);
+  for(uint32_t i = 0; i < header.records; ++i){
+    const Record& rec = records[i];
+    if(rec.type == Expression::Nothing || rec.type > Expression::Ap || rec.name >= symbols.size())
+      return false;
+    Expression expr(static_cast<Expression::Type>(rec.type));
+    bool lam = expr.isLam(), ap = expr.isAp();
+    if(rec.body > i || rec.arg > i || (lam || ap) != (rec.body != 0) || ap != (rec.arg != 0))
+      return false;
+    expr.val = rec.val;
+    expr.name = symbols[rec.name];
+    expr.body = refs[rec.body];
+    expr.arg = refs[rec.arg];
+    refs[i + 1] = Expression::make(expr);
+  }
+
+  const uint32_t * rules = reinterpret_cast<const uint32_t *>(data + rulesAt);
+  const uint32_t * binders = rules + header.rules;
+  if(header.file == 0 || header.file > header.records || header.hole == 0 || header.hole > header.records
+      || records[header.hole - 1].type != Expression::Var)
+    return false;
+  for(uint32_t i = 0; i < header.rules; ++i)
+    if(rules[i] == 0 || rules[i] > header.records) return false;
+  for(uint32_t i = 0; i < header.binders; ++i)
+    if(binders[i] >= symbols.size()) return false;
+
+  for(uint32_t i = 0; i < header.rules; ++i){
+    image.rules.push_back(refs[rules[i]]);
+    image.roots.push_back(Object(Expression::at(refs[rules[i]])));
+  }
+  image.file = refs[header.file];
+  image.hole = refs[header.hole];
+  image.roots.push_back(Object(Expression::at(image.file)));
+  for(uint32_t i = 0; i < header.binders; ++i)
+    image.binders.push_back(symbols[binders[i]]);
+  return true;
+}
+
+}
+
+uint64_t Snapshot::hash(const void * data, size_t length, uint64_t seed){
+  const unsigned char * bytes = static_cast<const unsigned char *>(data);
+  for(size_t i = 0; i < length; ++i){
+    seed ^= bytes[i];
+    seed *= 1099511628211ull;
+  }
+  return seed;
+}
+
+bool Snapshot::parse(const string& text, Image& image){
+  if(text.find(placeholder) != string::npos) return false;
+  Scanner scanner(text + "\n" + placeholder);
+  Expression::Ref file = parseExpression(scanner);
+  bool whole = false;
+  image.binders.clear();
+  if(!find(file, intern(placeholder), true, image, whole) || !whole) return false;
+  image.file = file;
+  image.roots.push_back(Object(Expression::at(file)));
+  return true;
+}
+
+bool Snapshot::load(const char * path, uint64_t key, Image& image){
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return false;
+  struct stat status;
+  if(fstat(fd, &status) < 0 || status.st_size == 0){
+    close(fd);
+    return false;
+  }
+  size_t size = status.st_size;
+  void * mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) return false;
+  Image loaded;
+  bool good = read(static_cast<const char *>(mapping), size, key, loaded);
+  munmap(mapping, size);
+  if(good) image = loaded;
+  return good;
+}
+
+bool Snapshot::save(const char * path, uint64_t key, const Image& image){
+  Writer writer;
+  vector<uint32_t> rules, binders;
+  for(Expression::Ref rule : image.rules)
+    rules.push_back(writer.record(rule));
+  Header header;
+  memcpy(header.magic, Magic, sizeof(Magic));
+  header.version = Version;
+  header.file = writer.record(image.file);
+  header.hole = writer.record(image.hole);
+  for(Symbol name : image.binders)
+    binders.push_back(writer.symbol(name));
+  header.symbolBytes = writer.names.size();
+  header.symbols = writer.symbolCount();
+  header.records = writer.records.size();
+  header.rules = rules.size();
+  header.binders = binders.size();
+  header.key = key;
+
+  string out;
+  append(out, &header, 1);
+  out += writer.names;
+  out.resize(padded(out.size()), '\0');
+  append(out, writer.records.data(), writer.records.size());
+  append(out, rules.data(), rules.size());
+  append(out, binders.data(), binders.size());
+
+  // Written aside and renamed, so a run never maps half a snapshot
+  string temporary = string(path) + "." + to_string(getpid());
+  FILE * file = fopen(temporary.c_str(), "wb");
+  if(!file) return false;
+  bool good = fwrite(out.data(), 1, out.size(), file) == out.size();
+  good = fclose(file) == 0 && good;
+  if(good && rename(temporary.c_str(), path) == 0) return true;
+  remove(temporary.c_str());
+  return false;
+}
@@ -0,0 +1,49 @@
+#ifndef __ULC_SNAPSHOT_HPP__
+#define __ULC_SNAPSHOT_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ExpressionParser.hpp"
+#include "Runtime.hpp"
+
+// Precompiled prelude.
+//
+// An image holds the prelude parsed and resolved: the rules added to the
+// prelude context, then the prelude file with a hole where the program
+// goes. Saved to a file, it is mapped back at startup instead of parsing
+// it all again, as long as it was made from the same prelude: the file
+// records a key hashed from the prelude sources.
+namespace Snapshot{
+
+struct Image{
+  std::vector<Expression::Ref> rules;
+  Expression::Ref file;
+  // A variable in `file` to be overwritten with the program
+  Expression::Ref hole;
+  // Names bound around the hole, the outermost first
+  std::vector<Symbol> binders;
+  // Keep the expressions above from the collector until they are used
+  std::vector<Object> roots;
+
+  Image() : file(Expression::null), hole(Expression::null) {}
+};
+
+// FNV-1a, continuing from `seed`
+uint64_t hash(const void * data, size_t length, uint64_t seed = 14695981039346656037ull);
+
+// Parse the prelude file `text` into `image`, false if the program would
+// not be the body of a lambda, or all of it, once put after the prelude:
+// then both have to be parsed as one
+bool parse(const std::string& text, Image& image);
+
+// Fill `image` from the snapshot at `path`, false if it is missing, or
+// was made with another key or by another version
+bool load(const char * path, uint64_t key, Image& image);
+// Write `image` to `path`, replacing it at once
+bool save(const char * path, uint64_t key, const Image& image);
+
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+
+#include "Stats.hpp"
+
+using namespace std;
+
+#ifdef ULC_STATS
+
+size_t Stats::lookups = 0;
+thread_local size_t Stats::Nesting::current = 0;
+
+namespace{
+
+using Clock = chrono::steady_clock;
+
+struct Centre{
+  string name;
+  double seconds;
+  size_t reductions;
+};
+
+// The first one takes what no name does
+vector<Centre> centres(1, Centre{"<main>", 0, 0});
+unordered_map<string, uint32_t> centreIndex;
+// Centre, plus one, of the expression at each ref; 0 for the expressions
+// made while evaluating, these keep the current centre
+vector<uint32_t> owners;
+
+size_t betas = 0;
+size_t forces = 0;
+size_t updates = 0;
+size_t maxDepth = 0;
+
+mutex primitiveLock;
+unordered_map<const Native *, size_t> primitiveCalls;
+
+thread_local uint32_t current = 0;
+// The centres to go back to once the thunks being evaluated are updated
+thread_local vector<uint32_t> entered;
+thread_local Clock::time_point since;
+
+uint32_t centre(const string& name){
+  auto it = centreIndex.find(name);
+  if(it != centreIndex.end()) return it->second;
+  centres.push_back(Centre{name, 0, 0});
+  return centreIndex[name] = centres.size() - 1;
+}
+
+void own(Expression::Ref ref, uint32_t centre){
+  if(owners.size() <= ref)
+    owners.resize(max<size_t>(ref + 1, owners.size() * 2), 0);
+  owners[ref] = centre + 1;
+}
+
+// The code of a lambda or an application is known by its children
+uint32_t owner(const Expression& expr){
+  if(!expr.isLam() && !expr.isAp()) return 0;
+  return expr.body < owners.size() ? owners[expr.body] : 0;
+}
+
+// The bound expression of a `let` belongs to its name, the rest to the
+// centre of the enclosing expression
+void walk(Expression::Ref ref, uint32_t centre){
+  vector<pair<Expression::Ref, uint32_t>> pending(1, make_pair(ref, centre));
+  while(!pending.empty()){
+    Expression::Ref r = pending.back().first;
+    uint32_t c = pending.back().second;
+    pending.pop_back();
+    own(r, c);
+    const Expression& expr = Expression::at(r);
+    if(expr.isLam()){
+      pending.emplace_back(expr.body, c);
+    }else if(expr.isAp()){
+      const Expression& fun = Expression::at(expr.body);
+      pending.emplace_back(expr.arg, fun.isLam() ? ::centre(symbolName(fun.name)) : c);
+      pending.emplace_back(expr.body, c);
+    }
+  }
+}
+
+// Charge the time since the last switch to the current centre
+void charge(){
+  Clock::time_point now = Clock::now();
+  if(since != Clock::time_point())
+    centres[current].seconds += chrono::duration<double>(now - since).count();
+  since = now;
+}
+
+}
+
+void Stats::beta(const Expression * lambda){
+  ++betas;
+  charge();
+  if(uint32_t c = lambda ? owner(*lambda) : 0)
+    current = c - 1;
+  ++centres[current].reductions;
+}
+
+void Stats::enter(const Expression& expr){
+  ++forces;
+  charge();
+  entered.push_back(current);
+  if(uint32_t c = owner(expr))
+    current = c - 1;
+}
+
+void Stats::leave(){
+  ++updates;
+  charge();
+  if(!entered.empty()){
+    current = entered.back();
+    entered.pop_back();
+  }
+}
+
+void Stats::primitive(const Native& native){
+  ++centres[current].reductions;
+  lock_guard<mutex> lock(primitiveLock);
+  ++primitiveCalls[&native];
+}
+
+void Stats::depth(size_t n){
+  if(n > maxDepth) maxDepth = n;
+}
+
+bool Stats::available(){
+  return true;
+}
+
+void Stats::name(const string& name, Expression::Ref ref){
+  walk(ref, centre(name));
+}
+
+void Stats::start(Expression::Ref program){
+  walk(program, 0);
+  current = 0;
+  since = Clock::now();
+}
+
+void Stats::print(ostream& out){
+  charge();
+  out << "[Stats] beta reductions: " << betas
+      << ", variable lookups: " << lookups
+      << ", thunk forces: " << forces
+      << ", thunk updates: " << updates
+      << ", max depth: " << maxDepth << endl;
+
+  vector<pair<const Native *, size_t>> calls(primitiveCalls.begin(), primitiveCalls.end());
+  sort(calls.begin(), calls.end(), [](const pair<const Native *, size_t>& a, const pair<const Native *, size_t>& b){
+    return a.second > b.second;
+  });
+  for(const auto& call : calls)
+    out << "[Stats] calls of " << call.first->name << ": " << call.second << endl;
+
+  // The names costing the most time
+  const size_t Shown = 20;
+  vector<const Centre *> costs;
+  for(const Centre& c : centres)
+    if(c.reductions) costs.push_back(&c);
+  sort(costs.begin(), costs.end(), [](const Centre * a, const Centre * b){ return a->seconds > b->seconds;});
+  if(costs.size() > Shown) costs.resize(Shown);
+  for(const Centre * c : costs)
+    out << "[Stats] " << c->name << ": " << c->seconds * 1000 << "ms, "
+        << c->reductions << " reductions" << endl;
+}
+
+#else
+
+bool Stats::available(){
+  return false;
+}
+
+void Stats::name(const string&, Expression::Ref){}
+void Stats::start(Expression::Ref){}
+void Stats::print(ostream&){}
+
+#endif
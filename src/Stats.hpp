@@ -0,0 +1,56 @@
+#ifndef __ULC_STATS_HPP__
+#define __ULC_STATS_HPP__
+
+#include <iostream>
+
+#include "Runtime.hpp"
+
+// Evaluator statistics for --stats, only compiled in by `make STATS=1`,
+// which defines ULC_STATS. Otherwise `STATS(...)` drops its arguments and
+// the evaluators carry no trace of them.
+//
+// Time and reductions are also charged to names: every expression of the
+// program belongs to the innermost `let` whose bound expression it is
+// written in. The evaluation is charged to the owner of the code being
+// run: of the lambda reduced last, or of the thunk entered last until it
+// is updated. Figures are approximate while several threads evaluate.
+#ifdef ULC_STATS
+#define STATS(...) __VA_ARGS__
+#else
+#define STATS(...)
+#endif
+
+namespace Stats{
+
+#ifdef ULC_STATS
+extern size_t lookups;
+
+// A beta reduction of `lambda`, 0 if the engine does not know which
+void beta(const Expression * lambda);
+// Entering a thunk of `expr` to evaluate it, and writing back its value
+void enter(const Expression& expr);
+void leave();
+void primitive(const Native&);
+void depth(size_t);
+
+// Nesting of the recursive evaluator
+class Nesting{
+    static thread_local size_t current;
+  public:
+    Nesting() { depth(++current);}
+    ~Nesting() { --current;}
+};
+#endif
+
+// False if the statistics were not compiled in
+bool available();
+// Charge the expressions under `ref` to `name`
+void name(const std::string& name, Expression::Ref ref);
+// Charge the expressions of `program` to the names bound around them,
+// and start the clock
+void start(Expression::Ref program);
+void print(std::ostream&);
+
+}
+
+#endif
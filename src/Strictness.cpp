@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <unordered_map>
+
+#include "Strictness.hpp"
+
+using namespace std;
+
+namespace{
+
+using Ref = Expression::Ref;
+
+// Deepest nesting walked by the recursive analysis
+const int Deep = 10000;
+// Rounds given to the fixpoint of a recursive function, past them it is
+// taken as evaluating none of its arguments
+const int Rounds = 4;
+
+// Levels of the variables an evaluation is sure to evaluate, sorted. The
+// level of a variable counts the binders above its own.
+using Demand = vector<int>;
+
+Demand join(const Demand& a, const Demand& b){
+  Demand c;
+  set_union(a.begin(), a.end(), b.begin(), b.end(), back_inserter(c));
+  return c;
+}
+
+Demand meet(const Demand& a, const Demand& b){
+  Demand c;
+  set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(c));
+  return c;
+}
+
+// What a function does once applied to all of its arguments
+struct Signature{
+  // The arguments it evaluates, the first one first; empty if not known
+  vector<bool> strict;
+  // It returns a boolean, choosing between the two arguments applied from
+  // this one on; -1 if it does not
+  int branches;
+  // It has an effect
+  bool effect;
+
+  Signature() : branches(-1), effect(false) {}
+  Signature(const vector<bool>& s, int b, bool e) : strict(s), branches(b), effect(e) {}
+};
+
+struct Info{
+  Demand demand;
+  // Of the value, if it is a function
+  Signature signature;
+  // The evaluation may have an effect
+  bool effect;
+
+  Info() : effect(false) {}
+};
+
+// The prelude and what is known of it, shared by the analyses of its
+// rules and of the program
+struct Prelude{
+  const Context& context;
+  unordered_map<int, Signature> signatures;
+  // Lambdas already marked, later marks may only lower theirs
+  vector<bool> seen;
+
+  Prelude(const Context& c) : context(c) {}
+
+  bool isFix(int k) const {
+    Symbol name = context.name(k);
+    return name && context[k].isPrimitive() && symbolName(name) == "Y";
+  }
+
+  const Signature& signature(int k);
+
+  void mark(Ref ref, int strict){
+    if(seen.size() <= ref)
+      seen.resize(max<size_t>(ref + 1, seen.size() * 2), false);
+    int& flag = Expression::at(ref).strict;
+    flag = seen[ref] ? min(flag, strict) : strict;
+    seen[ref] = true;
+  }
+
+  // The lambdas under `ref` evaluate their variables lazily
+  void clear(Ref ref){
+    vector<Ref> pending(1, ref);
+    while(!pending.empty()){
+      Ref r = pending.back();
+      pending.pop_back();
+      const Expression expr = Expression::at(r);
+      if(expr.isLam()){
+        mark(r, 0);
+        pending.push_back(expr.body);
+      }else if(expr.isAp()){
+        pending.push_back(expr.body);
+        pending.push_back(expr.arg);
+      }
+    }
+  }
+};
+
+// The lambdas on top of an expression and what their body does
+struct Chain{
+  vector<bool> strict;
+  Info body;
+};
+
+class Analysis{
+    Prelude& prelude;
+    // Index in the prelude of the frame a `Var` right past the binders
+    // refers to
+    int base;
+    // Signatures of the variables bound above, by level
+    vector<Signature> bound;
+    // Rounds of a fixpoint assume what they find, they mark nothing
+    bool marking;
+
+  public:
+    Analysis(Prelude& p, int b) : prelude(p), base(b), marking(true) {}
+
+    // The lambdas on top of `ref`, their variables bound to functions of
+    // `params` as far as given. They are marked lazy if `lazy`.
+    Chain lambdas(Ref ref, int depth, int nesting, const vector<Signature>& params, bool lazy){
+      vector<Ref> refs;
+      Ref r = ref;
+      while(Expression::at(r).isLam() && nesting + (int)refs.size() <= Deep){
+        bound.push_back(refs.size() < params.size() ? params[refs.size()] : Signature());
+        refs.push_back(r);
+        r = Expression::at(r).body;
+      }
+      int k = refs.size();
+      Chain chain;
+      chain.body = analyse(r, depth + k, nesting + k);
+      bound.resize(depth);
+      Demand& demand = chain.body.demand;
+      for(int i = 0; i < k; ++i){
+        chain.strict.push_back(binary_search(demand.begin(), demand.end(), depth + i));
+        if(marking)
+          prelude.mark(refs[i], !lazy && chain.strict[i] ? k - i : 0);
+      }
+      demand.erase(lower_bound(demand.begin(), demand.end(), depth), demand.end());
+      return chain;
+    }
+
+    // `Y` applied to `fun`: the recursive function it makes
+    Signature fix(Ref fun, int depth, int nesting){
+      int k = 0;
+      for(Ref r = Expression::at(fun).body; Expression::at(r).isLam(); r = Expression::at(r).body)
+        ++k;
+      // From the function evaluating all of its arguments, down to what
+      // its body really evaluates
+      Signature self(vector<bool>(k, true), -1, false);
+      bool was = marking;
+      marking = false;
+      int round = 0;
+      for(; round < Rounds; ++round){
+        Chain chain = lambdas(fun, depth, nesting, vector<Signature>(1, self), false);
+        vector<bool> found(chain.strict.begin() + 1, chain.strict.end());
+        if(found == self.strict) break;
+        self.strict = found;
+      }
+      if(round == Rounds)
+        self.strict.assign(k, false);
+      marking = was;
+      Chain chain = lambdas(fun, depth, nesting, vector<Signature>(1, self), false);
+      return Signature(vector<bool>(chain.strict.begin() + 1, chain.strict.end()), -1, false);
+    }
+
+    Info spine(Ref ref, int depth, int nesting){
+      vector<Ref> args;
+      Ref head = ref;
+      for(; Expression::at(head).isAp(); head = Expression::at(head).body)
+        args.push_back(Expression::at(head).arg);
+      // The first argument first
+      reverse(args.begin(), args.end());
+      int n = args.size();
+      if(nesting + n > Deep){
+        prelude.clear(ref);
+        return Info();
+      }
+      nesting += n;
+      const Expression h = Expression::at(head);
+      vector<Info> infos(n);
+      bool fixed = h.isVar() && h.index >= depth && prelude.isFix(h.index - depth + base)
+        && Expression::at(args[0]).isLam();
+      for(int i = fixed ? 1 : 0; i < n; ++i)
+        infos[i] = analyse(args[i], depth, nesting);
+      bool effect = any_of(infos.begin(), infos.end(), [](const Info& info){ return info.effect;});
+
+      Info info;
+      if(h.isLam()){
+        // A `let`, its variables bound to the functions it binds
+        vector<Signature> params;
+        for(const Info& arg : infos)
+          params.push_back(arg.signature);
+        Chain chain = lambdas(head, depth, nesting, params, effect);
+        int k = chain.strict.size();
+        info.effect = effect || chain.body.effect;
+        if(n < k || info.effect) return info;
+        info.demand = chain.body.demand;
+        for(int i = 0; i < k; ++i)
+          if(chain.strict[i]) info.demand = join(info.demand, infos[i].demand);
+        if(n == k) info.signature = chain.body.signature;
+        return info;
+      }
+
+      Signature signature;
+      if(fixed){
+        infos[0].signature = fix(args[0], depth, nesting);
+        signature = infos[0].signature;
+        // What is applied to the function made
+        infos.erase(infos.begin());
+        --n;
+      }else if(h.isVar() && h.index >= depth){
+        signature = prelude.signature(h.index - depth + base);
+      }else if(h.isVar() && h.index >= 0){
+        info.demand.push_back(depth - 1 - h.index);
+        signature = bound[depth - 1 - h.index];
+      }
+      int arity = signature.strict.size();
+      if(arity == 0 || n < arity){
+        info.effect = effect;
+        if(fixed && n == 0) info.signature = signature;
+        return info;
+      }
+      info.effect = effect || signature.effect;
+      if(effect) return info;
+      for(int i = 0; i < arity; ++i)
+        if(signature.strict[i]) info.demand = join(info.demand, infos[i].demand);
+      int b = signature.branches;
+      if(b >= 0 && n >= b + 2)
+        info.demand = join(info.demand, meet(infos[b].demand, infos[b + 1].demand));
+      return info;
+    }
+
+    // `depth` counts the binders above `ref`, `nesting` all of its parents
+    Info analyse(Ref ref, int depth, int nesting){
+      if(nesting > Deep){
+        prelude.clear(ref);
+        return Info();
+      }
+      const Expression expr = Expression::at(ref);
+      Info info;
+      switch(expr.type){
+        case Expression::Var:
+          if(expr.index >= depth){
+            info.signature = prelude.signature(expr.index - depth + base);
+          }else if(expr.index >= 0){
+            info.demand.push_back(depth - 1 - expr.index);
+            info.signature = bound[depth - 1 - expr.index];
+          }
+          break;
+        case Expression::Lambda:
+          info.signature.strict = lambdas(ref, depth, nesting, vector<Signature>(), false).strict;
+          break;
+        case Expression::Ap:
+          return spine(ref, depth, nesting);
+        default:
+          break;
+      }
+      return info;
+    }
+};
+
+const Signature& Prelude::signature(int k){
+  auto it = signatures.find(k);
+  if(it != signatures.end()) return it->second;
+  Signature signature;
+  Symbol name = context.name(k);
+  const Object& rule = context[k];
+  if(name && rule.isPrimitive()){
+    const Native& native = *rule.native();
+    for(int i = 0; i < native.arity; ++i)
+      signature.strict.push_back(native.strict >> i & 1);
+    signature.branches = native.branches;
+    signature.effect = native.effect;
+  }else if(name && rule.type() == Object::Closure && rule.expr().isLam() && rule.env() == context.drop(k + 1)){
+    // The rule is copied, so that its object sees its own marks
+    Ref ref = Expression::make(rule.expr());
+    Analysis analysis(*this, k + 1);
+    signature = analysis.analyse(ref, 0, 0).signature;
+    if(symbolName(name) == "if")
+      signature.branches = 1;
+    context[k] = Object(Expression::at(ref), rule.env());
+  }
+  return signatures[k] = signature;
+}
+
+}
+
+void Strictness::analyse(Expression::Ref program, const Context& context){
+  Prelude prelude(context);
+  Analysis analysis(prelude, 0);
+  analysis.analyse(program, 0, 0);
+}
@@ -0,0 +1,30 @@
+#ifndef __ULC_STRICTNESS_HPP__
+#define __ULC_STRICTNESS_HPP__
+
+#include "Runtime.hpp"
+
+// Strictness analysis of a resolved program.
+//
+// A lambda whose body is sure to evaluate its variable, once the lambdas
+// right below it are applied too, gets its `strict` count set. The
+// evaluators then evaluate such an argument before the body instead of
+// building a thunk of it, when the application spine holds enough
+// arguments. What a function evaluates is known from the arithmetic and
+// list natives, from `if` and the booleans they return, from the lambdas
+// bound by `let`, and from recursive functions made with `Y`, found by a
+// fixpoint.
+//
+// Nothing is evaluated ahead of an IO native applied to its world, or of
+// an expression calling one: the effects keep their order. A program
+// going wrong in a strict argument may stop with another error than the
+// one it would have met first. Subterms nested deeper than the C++ stack
+// allows stay lazy.
+namespace Strictness{
+
+// Set the strictness of the lambdas of `program` and of the rules of
+// `prelude` it is resolved in
+void analyse(Expression::Ref program, const Context& prelude);
+
+}
+
+#endif
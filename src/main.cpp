@@ -3,393 +3,583 @@
 #include <fstream>
 #include <string>
 #include <algorithm>
-#include <functional>
 #include <vector>
 #include <deque>
 #include <memory>
 #include <sstream>
 
 #include <cstdio>
+#include <cstring>
+#include <cctype>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "ExpressionParser.hpp"
-#include "Dictionary.hpp"
+#include "Runtime.hpp"
+#include "Collector.hpp"
+#include "Bytecode.hpp"
+#include "Parallel.hpp"
+#include "IO.hpp"
+#include "Snapshot.hpp"
+#include "Json.hpp"
+#include "Stats.hpp"
+#include "Governor.hpp"
+#include "Optimizer.hpp"
+#include "Strictness.hpp"
+#include "Codegen.hpp"
+#include "Server.hpp"
 
 using namespace std;
 
-/* Data structures
- *
- * data Expression = Var | Lambda | Ap
- *
- * data Object  = Callable Expression
- * data Context = Map Var/String Object
- * normalForm :: Context -> Expression -> Object
- * weakNormalForm :: Context -> Expression -> Object
- *
- * type Primitive = Var -> Expression
- * data Object = Object Expression Context | Primitive Context
- * data Context = [(Var, Object)]
- *
- * weakNormalForm :: Object -> Object
- * normalForm :: Object -> Object
- *
- * weakNormalForm / normalForm morphs a object (beta reduction)
- *
- */
-
-class Object;
-class Context;
-
-class Context{
-    Dictionary<shared_ptr<Object>> _env;
-  public:
-    Context() {}
-    Context(const Context& context) : _env(context._env) {}
-    Context(const Dictionary<shared_ptr<Object>>& d) : _env(d) {}
-
-    Context& add(const string&, const string&);
-    Context& add(const string&, const Object&);
-    Context insert(const string&, const Object&) const;
-    Context erase(const string&) const;
-    Object& lookup(const string&) const;
-    Object& operator [] (const string&) const;
-    bool exist(const string&) const;
-};
-
-class Object{
-  public:
-    using Func = function<Object(const Expression&, const Context&)>;
-    enum Type{Primitive, Closure, NormalForm};
-  private:
-    Type _type;
-    Expression _expr;
-    Context _env;
-    Func _func;
+namespace{
 
-    Object(Type t, const Expression& expr) : _type(t), _expr(expr) {}
-  public:
-    Object(const Expression& expr) : _type(Closure), _expr(expr), _env() {}
-    Object(const Expression& expr, const Context& env) : _type(Closure), _expr(expr), _env(env) {}
-    Object(const Func& func) : _type(Primitive), _func(func) {}
-
-    const Expression& expr() const { return _expr;}
-    const Context& env() const { return _env;}
-
-    Object call(const Expression& expr, const Context& env) const;
+// A closed term, parsed once
+Object closed(const char * source){
+  Scanner scanner(source);
+  Expression& expr = Expression::at(parseExpression(scanner));
+  Context().resolve(expr);
+  return Object(expr);
+}
 
-    bool callable() const;
+const Object& boolean(bool b){
+  static const Object yes = closed("\\a \\b a"), no = closed("\\a \\b b");
+  return b ? yes : no;
+}
 
-    Type type() const { return _type;}
-    bool isNormalForm() const { return _type == NormalForm;}
-    bool isPrimitive() const { return _type == Primitive;}
+int number(const Object& obj){
+  return normalForm(obj.expr(), obj.env()).expr().val;
+}
 
-    friend Object makeNormalForm(const Expression&);
-};
+// Both operands of a primitive strict in both, the first one first. With
+// several threads the second one is sparked while the first one is
+// evaluated, then joined through its frame.
+pair<int, int> operands(const Object * args){
+  const Object& a = args[1];
+  const Object& b = args[0];
+  if(Parallel::threads() == 1 || b.expr().isNum()){
+    int x = number(a);
+    return make_pair(x, number(b));
+  }
+  const Expression& expr = b.expr();
+  Context second = expr.isVar() && expr.index >= 0 ? b.env().drop(expr.index) : Context().insert(b);
+  Parallel::spark(second);
+  int x = number(a);
+  Parallel::cancel(second);
+  Expression var(Expression::Var);
+  var.index = 0;
+  return make_pair(x, normalForm(var, second).expr().val);
+}
 
-Context& Context::add(const string& name, const string& rule) {
-  Scanner scanner(rule);
-  auto expr = parseExpression(scanner);
-  return add(name, Object(*expr, *this));
+// pair a s, what an IO action returns. The world is evaluated first: as
+// a closure it would hold the context of the action, which holds the world
+// of the action before, and so on back to the first one.
+Object ioResult(const Object& a, const Object& s){
+  static const Object pair = closed("\\a \\s \\p p a s");
+  const Expression& lam = Expression::at(Expression::at(pair.expr().body).body);
+  Object world = s.isNormalForm() ? s : weakNormalForm(s.expr(), s.env());
+  return Object(lam, Context().insert(a).insert(world));
 }
 
-Context& Context::add(const string& name, const Object& rule){
-  *this = _env.insert(name, shared_ptr<Object>(new Object(rule)));
-  return *this;
+// Lists keep the Scott encoding, [] = \s \z z and : x xs = \s \z s x xs,
+// so a program may still apply them. `head`, `tail` and `empty?` know the
+// cells made by `[]` and `:` and read their fields without applying them.
+const Object& nil(){
+  static const Object empty = closed("\\s \\z z");
+  return empty;
 }
 
-Context Context::insert(const string& str, const Object& obj) const {
-  return this->_env.insert(str, shared_ptr<Object>(new Object(obj)));
+// \s \z s x xs, in a context binding `xs` on top of `x`
+const Expression& cell(){
+  static const Object cons = closed("\\x \\xs \\s \\z s x xs");
+  return Expression::at(Expression::at(cons.expr().body).body);
 }
 
-Context Context::erase(const string& str) const {
-  return this->_env.erase(str);
+bool isNil(const Object& list){
+  return list.type() == Object::Closure && list.expr().isLam() && list.expr().body == nil().expr().body;
 }
 
-Object& Context::lookup(const string& str) const {
-  return (*this)[str];
+bool isCell(const Object& list){
+  return list.type() == Object::Closure && list.expr().isLam() && list.expr().body == cell().body;
 }
 
-Object& Context::operator [] (const string& str) const {
-  if(_env.exist(str)){
-    return *_env[str];
-  }else{
-    cerr << "[Context lookup] Unexpected free variable: " << str << endl;
-    exit(1);
-  }
+// The frame `index` of `env`, updated once it is evaluated
+Object slot(const Context& env, int index){
+  static const Object top = [](){
+    Expression var(Expression::Var);
+    var.index = 0;
+    return Object(var);
+  }();
+  return Object(top.expr(), env.drop(index));
 }
 
-bool Context::exist(const string& str) const {
-  return _env.exist(str);
+// Apply the closed lambda `f` to the value `v`, for the lists which are
+// not cells
+Object applyTo(const Object& f, const Object& v){
+  Object arg = slot(Context().insert(v), 0);
+  return f.call(arg.expr(), arg.env());
 }
 
-bool Object::callable() const {
-  if(type() == Primitive){
-    /* TODO */
-    return true;
-  }else{
-    if(_expr.isLam()){
-      return true;
-    }else{
-      return false;
-    }
-  }
+// The list of the characters of `bytes`
+Object fromBytes(const string& bytes){
+  Object list = nil();
+  for(size_t i = bytes.size(); i-- > 0; )
+    list = Object(cell(), Context().insert(makeNormalForm(Expression((unsigned char)bytes[i]))).insert(list));
+  return list;
 }
 
-Object Object::call(const Expression& expr, const Context& env) const {
-  if(type() == Primitive){
-    /* TODO */
-    return _func(expr, env);
-  }else{
-    if(_expr.isLam()){
-      return Object(*_expr.body, _env.insert(_expr.name, Object(expr, env)));
-    }else{
-      cerr << "[Object call] Object not callable (not a `Lambda`): " << _expr.type << endl;
-      exit(1);
-    }
-  }
+void divisionByZero(){
+  Parallel::fizzle();
+  cerr << "[Runtime] Division by zero" << endl;
+  Governor::stop(Governor::Failure);
 }
 
-Object makeNormalForm(const Expression& expr){
-  return Object(Object::NormalForm, expr);
+// Y f = f (Y f)
+// The knot is tied through one frame, every unfolding shares its thunk
+Object fix(const Object * args){
+  static const Object self = [](){
+    Expression var(Expression::Var);
+    var.name = intern("Y");
+    var.index = 0;
+    return Object(var);
+  }();
+  static const Object body = [](){
+    Expression f(Expression::Var), ap(Expression::Ap);
+    f.name = intern("f");
+    f.index = 1;
+    ap.body = Expression::make(f);
+    ap.arg = Expression::make(self.expr());
+    return Object(ap);
+  }();
+  Context knot = Context().insert(args[0]).insert(self);
+  knot[0] = Object(body.expr(), knot);
+  return Object(self.expr(), knot);
 }
 
-Object weakNormalForm(const Expression& expr, const Context& env);
-Object normalForm(const Expression& expr, const Context& env);
-
-Object weakNormalForm(const Expression& expr, const Context& env){
-  switch( expr.type ){
-    case Expression::Constant:
-      return makeNormalForm( expr );
-      break;
-    case Expression::Var:
-      if( env.exist(expr.name) ){
-        Object& res = env[expr.name];
-        if( res.isNormalForm() )
-          return res;
-        if( res.isPrimitive() )
-          return res;
-        return res = weakNormalForm( res.expr(), res.env() );
-      }else{
-        return makeNormalForm( expr );
-      }
-      break;
-    case Expression::Lambda:
-      return Object(expr, env);
-      break;
-    case Expression::Ap:
-      {
-        const Expression& body = *expr.body;
-        const Expression& arg = *expr.arg;
-        Object callee(weakNormalForm(body, env));
-        if( callee.callable() ){
-          Object res = callee.call(arg, env);
-          if( res.isNormalForm() )
-            return res;
-          if( res.isPrimitive() )
-            return res;
-          return weakNormalForm(res.expr(), res.env());
+// Name, arity, operation, strict arguments, branches, effect, code
+const Native natives[] = {
+  {"Y", 1, Native::None, 0, -1, false, fix},
+  {"+", 2, Native::Add, 3, -1, false, [](const Object * args) -> Object {
+      pair<int, int> ab = operands(args);
+      return Expression( ab.first + ab.second );
+    }},
+  {"-", 2, Native::Sub, 3, -1, false, [](const Object * args) -> Object {
+      pair<int, int> ab = operands(args);
+      return Expression( ab.first - ab.second );
+    }},
+  // Not strict in its second operand, that one is never sparked
+  {"*", 2, Native::Mul, 1, -1, false, [](const Object * args) -> Object {
+      int a = number(args[1]);
+      if(a == 0)
+        return Expression( 0 );
+      return Expression( a * number(args[0]) );
+    }},
+  {"/", 2, Native::Div, 3, -1, false, [](const Object * args) -> Object {
+      pair<int, int> ab = operands(args);
+      if(ab.second == 0) divisionByZero();
+      return Expression( ab.first / ab.second );
+    }},
+  {"mod", 2, Native::Mod, 3, -1, false, [](const Object * args) -> Object {
+      pair<int, int> ab = operands(args);
+      if(ab.second == 0) divisionByZero();
+      return Expression( ab.first % ab.second );
+    }},
+  {"==", 2, Native::Eq, 3, 2, false, [](const Object * args) -> Object {
+      pair<int, int> ab = operands(args);
+      return boolean(ab.first == ab.second);
+    }},
+  {"<", 2, Native::Lt, 3, 2, false, [](const Object * args) -> Object {
+      pair<int, int> ab = operands(args);
+      return boolean(ab.first < ab.second);
+    }},
+  {"<=", 2, Native::Le, 3, 2, false, [](const Object * args) -> Object {
+      pair<int, int> ab = operands(args);
+      return boolean(ab.first <= ab.second);
+    }},
+  // par a b: `a` may be evaluated by an idle thread, the result is `b`.
+  // Strict in neither, that is what it is for.
+  {"par", 2, Native::None, 0, -1, false, [](const Object * args) -> Object {
+      const Expression& a = args[1].expr();
+      if(a.isVar() && a.index >= 0)
+        Parallel::spark(args[1].env().drop(a.index));
+      else if(!a.isNum() && !a.isLam())
+        Parallel::spark(Context().insert(args[1]));
+      return args[0];
+    }},
+  {":", 2, Native::None, 0, -1, false, [](const Object * args) -> Object {
+      return Object(cell(), Context().insert(args[1]).insert(args[0]));
+    }},
+  {"head", 1, Native::None, 1, -1, false, [](const Object * args) -> Object {
+      static const Object scott = closed("\\x x (\\a \\_ a) _");
+      Object list = weakNormalForm(args[0].expr(), args[0].env());
+      return isCell(list) ? slot(list.env(), 1) : applyTo(scott, list);
+    }},
+  {"tail", 1, Native::None, 1, -1, false, [](const Object * args) -> Object {
+      static const Object scott = closed("\\x x (\\_ \\b b) _");
+      Object list = weakNormalForm(args[0].expr(), args[0].env());
+      return isCell(list) ? slot(list.env(), 0) : applyTo(scott, list);
+    }},
+  {"empty?", 1, Native::None, 1, 1, false, [](const Object * args) -> Object {
+      static const Object scott = closed("\\x x (\\_ \\_ \\a \\b b) (\\a \\b a)");
+      Object list = weakNormalForm(args[0].expr(), args[0].env());
+      if(isCell(list) || isNil(list))
+        return boolean(isNil(list));
+      return applyTo(scott, list);
+    }},
+  // putChar c s
+  {"putChar", 2, Native::None, 0, -1, true, [](const Object * args) -> Object {
+      IO::put(number(args[1]));
+      return ioResult(Object(Expression("nil")), args[0]);
+    }},
+  // getChar s
+  {"getChar", 1, Native::None, 0, -1, true, [](const Object * args) -> Object {
+      return ioResult(Object(Expression(IO::get())), args[0]);
+    }},
+  // putStr str s, the whole string in one call
+  {"putStr", 2, Native::None, 0, -1, true, [](const Object * args) -> Object {
+      // For the lists built by the program, given their two continuations
+      static const Object empty = closed("\\x x (\\_ \\_ 0) 1");
+      static const Object first = closed("\\x x (\\a \\_ a) _");
+      static const Object rest = closed("\\x x (\\_ \\b b) _");
+      Object list = weakNormalForm(args[1].expr(), args[1].env());
+      while(!isNil(list)){
+        Object next = list;
+        if(isCell(list)){
+          IO::put(number(slot(list.env(), 1)));
+          next = slot(list.env(), 0);
         }else{
-          Expression expr2(Expression::Ap);
-          expr2.body = new Expression(callee.expr());
-          expr2.arg = new Expression(normalForm(arg, env).expr());
-          return makeNormalForm( expr2 );
+          if(number(applyTo(empty, list))) break;
+          IO::put(number(applyTo(first, list)));
+          next = applyTo(rest, list);
         }
+        list = weakNormalForm(next.expr(), next.env());
       }
-      break;
-    case Expression::Nothing:
-      cerr << "[Weak normal form] Unexpected expression type: " << expr.type << endl;
-      exit(1);
+      return ioResult(Object(Expression("nil")), args[0]);
+    }},
+  // getLine s, the line without its newline
+  {"getLine", 1, Native::None, 0, -1, true, [](const Object * args) -> Object {
+      string line;
+      for(int c = IO::get(); c != -1 && c != '\n'; c = IO::get())
+        line += c;
+      return ioResult(fromBytes(line), args[0]);
+    }},
+  // getContents s, the rest of the input
+  {"getContents", 1, Native::None, 0, -1, true, [](const Object * args) -> Object {
+      string contents;
+      for(int c = IO::get(); c != -1; c = IO::get())
+        contents += c;
+      return ioResult(fromBytes(contents), args[0]);
+    }},
+  // flush s
+  {"flush", 1, Native::None, 0, -1, true, [](const Object * args) -> Object {
+      IO::flush();
+      return ioResult(Object(Expression("nil")), args[0]);
+    }},
+};
+
+// Bindings of the prelude parsed from strings, a rule sees the bindings
+// before it. The natives and [] come between the basic and the derived
+// ones.
+struct Rule{
+  const char * name;
+  const char * source;
+};
+
+const Rule basics[] = {
+  {"true", "\\a \\b a"},
+  {"false", "\\a \\b b"},
+  {"if", "\\pred \\then \\else pred then else"},
+  {"not", "\\x x false true"},
+  {"and", "\\x \\y x y false"},
+  {"or", "\\x \\y x true y"},
+};
+
+const Rule derived[] = {
+  {"flip", "\\f \\x \\y f y x"},
+  {"!=", "\\a \\b not (== a b)"},
+  {">", "flip <"},
+  {">=", "flip >="},
+
+  {">>=", "\\m \\f \\s (m s) \\a \\s' f a s'"},
+  {">>", "\\ma \\mb >>= ma (\\_ mb)"},
+
+  {"runIO", "\\m m s"},
+  {"pair", "\\a \\b \\p p a b"},
+  {"pureIO", "pair"},
+};
+
+const char * const preludePath = "samplecode/prelude";
+
+// What a snapshot of the prelude depends on: the prelude file and the
+// bindings made before it
+uint64_t preludeKey(const string& text){
+  uint64_t key = Snapshot::hash(text.data(), text.size());
+  auto rules = [&key](const Rule& rule){
+    key = Snapshot::hash(rule.name, strlen(rule.name) + 1, key);
+    key = Snapshot::hash(rule.source, strlen(rule.source) + 1, key);
+  };
+  for_each(begin(basics), end(basics), rules);
+  for(const Native& native : natives){
+    key = Snapshot::hash(native.name, strlen(native.name) + 1, key);
+    key = Snapshot::hash(&native.arity, sizeof(native.arity), key);
   }
+  for_each(begin(derived), end(derived), rules);
+  return key;
 }
 
-Object normalForm(const Expression& expr, const Context& env){
-  switch( expr.type ){
-    case Expression::Constant:
-      return makeNormalForm( expr );
-      break;
-    case Expression::Var:
-      if( env.exist(expr.name) ){
-        Object &res = env[expr.name];
-        if( res.isNormalForm() )
-          return res;
-        if( res.isPrimitive() )
-          return res;
-        return res = normalForm( res.expr(), res.env() );
-      }else{
-        return makeNormalForm( expr );
-      }
-      break;
-    case Expression::Lambda:
-      {
-        Expression expr2(expr);
-        expr2.body = new Expression(normalForm(*expr.body, env.erase( expr.name )).expr());
-        return makeNormalForm( expr2 );
-      // return Object(expr2, env);
-      }
-      break;
-    case Expression::Ap:
-      {
-        const Expression& body = *expr.body;
-        const Expression& arg = *expr.arg;
-        Object callee(weakNormalForm(body, env));
-        if( callee.callable() ){
-          Object res = callee.call(arg, env);
-          if( res.isNormalForm() )
-            return res;
-          if( res.isPrimitive() )
-            return res;
-          return normalForm(res.expr(), res.env());
-        }else{
-          Expression expr2(Expression::Ap);
-          expr2.body = new Expression(callee.expr());
-          expr2.arg = new Expression(normalForm(arg, env).expr());
-          return makeNormalForm( expr2 );
-        }
-      }
-      break;
-    case Expression::Nothing:
-      cerr << "[Normal form] Unexpected expression type: " << expr.type << endl;
-      exit(1);
-  }
 }
 
 int main(int argc, char *argv[])
 {
+  bool heapStats = false, gcStats = false, evalStats = false, stats = false, dumpBytecode = false, printResult = false;
+  bool sequentialEngine = false, fromJson = false, toJson = false, dumpOptimized = false;
+  unsigned threads = 1;
+  int optimization = 0;
+  Governor::Limits limits = Governor::Limits();
+  const char * source = nullptr;
+  const char * snapshot = nullptr;
+  const char * compileTo = nullptr;
+  const char * serveAt = nullptr;
+  const char * connectTo = nullptr;
+  for(int i = 1; i < argc; ++i){
+    string arg(argv[i]);
+    if(arg == "--heap-stats"){
+      heapStats = true;
+    }else if(arg == "--gc-stats"){
+      gcStats = true;
+    }else if(arg == "--eval-stats"){
+      evalStats = true;
+    }else if(arg == "--stats"){
+      stats = true;
+    }else if(arg == "--engine=recursive"){
+      setEngine(Engine::Recursive);
+      sequentialEngine = false;
+    }else if(arg == "--engine=machine"){
+      setEngine(Engine::Machine);
+      sequentialEngine = false;
+    }else if(arg == "--engine=bytecode"){
+      setEngine(Engine::Bytecode);
+      sequentialEngine = true;
+    }else if(arg == "--engine=net"){
+      setEngine(Engine::Net);
+      sequentialEngine = true;
+    }else if(arg == "--engine=graph"){
+      setEngine(Engine::Graph);
+      sequentialEngine = true;
+    }else if(arg.compare(0, 10, "--threads=") == 0){
+      threads = strtoul(arg.c_str() + 10, nullptr, 10);
+    }else if(arg.compare(0, 14, "--input-block=") == 0){
+      IO::setInputBlock(strtoull(arg.c_str() + 14, nullptr, 10));
+    }else if(arg == "--print"){
+      printResult = true;
+    }else if(arg == "--from-json"){
+      fromJson = true;
+    }else if(arg == "--to-json"){
+      printResult = toJson = true;
+    }else if(arg.compare(0, 11, "--snapshot=") == 0){
+      snapshot = argv[i] + 11;
+    }else if(arg.compare(0, 8, "--serve=") == 0){
+      serveAt = argv[i] + 8;
+    }else if(arg.compare(0, 10, "--connect=") == 0){
+      connectTo = argv[i] + 10;
+    }else if(arg.compare(0, 10, "--compile=") == 0){
+      compileTo = argv[i] + 10;
+    }else if(arg == "--dump-bytecode"){
+      dumpBytecode = true;
+    }else if(arg == "--dump-optimized"){
+      dumpOptimized = true;
+    }else if(arg == "-O"){
+      optimization = 1;
+    }else if(arg.compare(0, 2, "-O") == 0 && arg.size() == 3 && isdigit(arg[2])){
+      optimization = arg[2] - '0';
+    }else if(arg.compare(0, 13, "--heap-limit=") == 0){
+      limits.heapBytes = strtoull(arg.c_str() + 13, nullptr, 10);
+    }else if(arg.compare(0, 7, "--fuel=") == 0){
+      limits.fuel = strtoull(arg.c_str() + 7, nullptr, 10);
+    }else if(arg.compare(0, 10, "--timeout=") == 0){
+      limits.seconds = strtod(arg.c_str() + 10, nullptr);
+    }else{
+      source = argv[i];
+    }
+  }
+
+  if((serveAt || connectTo) && fromJson){
+    cerr << "[Server] Programs are sent to a server in the usual syntax" << endl;
+    exit(1);
+  }
+  if(connectTo){
+    // The prelude is the server's, this process only sends the program
+    string program;
+    if(source){
+      ifstream file(source, ios::binary);
+      if(!file){
+        cerr << "[Main] Cannot read " << source << endl;
+        exit(1);
+      }
+      program.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }else{
+      program.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+    }
+    Server::Request request = {printResult, toJson, optimization, limits};
+    return Server::submit(connectTo, request, program);
+  }
+  if(serveAt && threads > 1){
+    cerr << "[Server] --serve needs a single thread" << endl;
+    exit(1);
+  }
+  if(threads > 1 && sequentialEngine){
+    cerr << "[Parallel] --threads needs the recursive or the machine engine" << endl;
+    exit(1);
+  }
+  if(stats && !Stats::available()){
+    cerr << "[Stats] Built without statistics, rebuild with `make STATS=1`" << endl;
+    exit(1);
+  }
+  Parallel::start(threads);
+
+  string preludeText;
+  {
+    ifstream file(preludePath, ios::binary);
+    preludeText.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+  }
+  uint64_t key = preludeKey(preludeText);
+  Snapshot::Image image;
+  bool cached = snapshot && Snapshot::load(snapshot, key, image)
+    && image.rules.size() == extent<decltype(basics)>::value + extent<decltype(derived)>::value;
+
   Context prelude;
-  prelude.add("true", "\\a \\b a");
-  prelude.add("false", "\\a \\b b");
-  prelude.add("if", "\\pred \\then \\else pred then else");
-  prelude.add("not", "\\x x false true");
-  prelude.add("and", "\\x \\y x y false");
-  prelude.add("or", "\\x \\y x true y");
-  // Y f = f (Y f)
-  prelude.add("Y", "\\f (\\x f (x x)) (\\x f (x x))");
-  prelude.add("+", Object([](const Expression& expr, const Context& env){
-          int a = normalForm(expr, env).expr().val;
-          return Object([a](const Expression& expr, const Context& env){
-              int b = normalForm(expr, env).expr().val;
-              return Expression( a + b );
-            });
-        }));
-  prelude.add("-", Object([](const Expression& expr, const Context& env){
-          int a = normalForm(expr, env).expr().val;
-          return Object([a](const Expression& expr, const Context& env){
-              int b = normalForm(expr, env).expr().val;
-              return Expression( a - b );
-            });
-        }));
-  prelude.add("*", Object([](const Expression& expr, const Context& env){
-          int a = normalForm(expr, env).expr().val;
-          return Object([a](const Expression& expr, const Context& env){
-              if(a == 0)
-                return Expression( 0 );
-              int b = normalForm(expr, env).expr().val;
-              return Expression( a * b );
-            });
-        }));
-  prelude.add("/", Object([](const Expression& expr, const Context& env){
-          int a = normalForm(expr, env).expr().val;
-          return Object([a](const Expression& expr, const Context& env){
-              int b = normalForm(expr, env).expr().val;
-              return Expression( a / b );
-            });
-        }));
-  prelude.add("mod", Object([](const Expression& expr, const Context& env){
-          int a = normalForm(expr, env).expr().val;
-          return Object([a](const Expression& expr, const Context& env){
-              int b = normalForm(expr, env).expr().val;
-              return Expression( a % b );
-            });
-        }));
-  prelude.add("==", Object([](const Expression& expr, const Context& env){
-          int a = normalForm(expr, env).expr().val;
-          return Object([a](const Expression& expr, const Context& env){
-              int b = normalForm(expr, env).expr().val;
-              if(a == b){
-                return Object(Expression("true"), env);
-              }else{
-                return Object(Expression("false"), env);
-              }
-            });
-        }));
-  prelude.add("<", Object([](const Expression& expr, const Context& env){
-          int a = normalForm(expr, env).expr().val;
-          return Object([a](const Expression& expr, const Context& env){
-              int b = normalForm(expr, env).expr().val;
-              if(a < b){
-                return Object(Expression("true"), env);
-              }else{
-                return Object(Expression("false"), env);
-              }
-            });
-        }));
-  prelude.add("<=", Object([](const Expression& expr, const Context& env){
-          int a = normalForm(expr, env).expr().val;
-          return Object([a](const Expression& expr, const Context& env){
-              int b = normalForm(expr, env).expr().val;
-              if(a <= b){
-                return Object(Expression("true"), env);
-              }else{
-                return Object(Expression("false"), env);
-              }
-            });
-        }));
-  prelude.add("flip", "\\f \\x \\y f y x");
-  prelude.add("!=", "\\a \\b not (== a b)");
-  prelude.add(">", "flip <");
-  prelude.add(">=", "flip >=");
-
-  prelude.add(">>=", "\\m \\f \\s (m s) \\a \\s' f a s'");
-  prelude.add(">>", "\\ma \\mb >>= ma (\\_ mb)");
-
-  prelude.add("runIO", "\\m m s");
-  prelude.add("pair", "\\a \\b \\p p a b");
-  prelude.add("pureIO", "pair");
-  prelude.add("putChar", Object([](const Expression& expr, const Context& env){
-        auto promiseChar = [expr, env](){ return normalForm(expr, env).expr().val;};
-        return Object([promiseChar](const Expression& s, const Context& env){
-          fputc(promiseChar(), stdout);
-          /* pair nil s */
-          return Object([s, env](const Expression& p, const Context& _env){
-            Object res = weakNormalForm(p, _env).call(Expression("nil"), {});
-            return weakNormalForm(res.expr(), res.env()).call(s, env);
-          });
-        });
-      }));
-  prelude.add("getChar", Object([](const Expression& s, const Context& env){
-        int c = fgetc(stdin);
-        return Object([c, s, env](const Expression& p, const Context& _env){
-          Object res = weakNormalForm(p, _env).call(Expression(c), {});
-          return weakNormalForm(res.expr(), res.env()).call(s, env);
-        });
-      }));
-
-  string rawInput, input;
-  ifstream file("samplecode/prelude");
-  while(getline(file, input)){
-    rawInput += input;
-    rawInput += "\n";
+  size_t next = 0;
+  auto add = [&prelude, &image, &next, cached, stats](const Rule& rule){
+    Expression::Ref ref;
+    if(cached){
+      ref = image.rules[next++];
+    }else{
+      Scanner scanner(rule.source);
+      ref = parseExpression(scanner);
+      prelude.resolve(Expression::at(ref));
+      image.rules.push_back(ref);
+    }
+    if(stats) Stats::name(rule.name, ref);
+    prelude.add(rule.name, Object(Expression::at(ref), prelude));
+  };
+  for_each(begin(basics), end(basics), add);
+  for(const Native& native : natives)
+    prelude.add(native.name, Object(native));
+  prelude.add("[]", nil());
+  for_each(begin(derived), end(derived), add);
+
+  bool hole = cached;
+  if(!cached && Snapshot::parse(preludeText, image)){
+    hole = true;
+    prelude.resolve(Expression::at(image.file));
+    if(snapshot && !Snapshot::save(snapshot, key, image))
+      cerr << "[Snapshot] Cannot write " << snapshot << endl;
   }
-  file.close();
-  if(argc > 1){
-    file.open(argv[1]);
-    while(getline(file, input)){
-      rawInput += input;
-      rawInput += "\n";
+
+  string served;
+  if(serveAt){
+    Server::Request request;
+    Server::serve(serveAt, limits, request, served);
+    // In the process evaluating a request
+    printResult = request.print;
+    toJson = request.json;
+    optimization = request.optimization;
+    limits = request.limits;
+  }
+
+  Expression::Ref parsed;
+  if(fromJson){
+    if(!hole){
+      cerr << "[Json] The prelude leaves no place for the program" << endl;
+      exit(1);
+    }
+    int fd = source ? open(source, O_RDONLY) : STDIN_FILENO;
+    if(fd < 0){
+      cerr << "[Main] Cannot read " << source << endl;
+      exit(1);
     }
-    file.close();
+    parsed = Json::read(fd);
+    if(source) close(fd);
   }else{
-    while(getline(cin, input)){
-      rawInput += input;
-      rawInput += "\n";
+    Scanner scanner;
+    // Without a hole in the prelude for the program, both are parsed as one
+    if(!hole) scanner.addFile(preludePath);
+    if(serveAt){
+      scanner.addText(served);
+    }else if(!source){
+      scanner.addStandardInput();
+    }else if(!scanner.addFile(source)){
+      cerr << "[Main] Cannot read " << source << endl;
+      exit(1);
     }
+    parsed = parseExpression(scanner);
+  }
+  if(hole){
+    Expression::at(image.hole) = Expression::at(parsed);
+    prelude.resolve(Expression::at(image.hole), image.binders);
+    parsed = image.file;
+  }else{
+    prelude.resolve(Expression::at(parsed));
+  }
+  parsed = Optimizer::optimize(parsed, prelude, optimization);
+  if(optimization >= 1)
+    Strictness::analyse(parsed, prelude);
+  Expression& expr = Expression::at(parsed);
+  if(dumpOptimized){
+    expr.prettyPrint();
+    cout << endl;
+    return 0;
+  }
+  if(dumpBytecode){
+    Bytecode::dump(expr, cout);
+    return 0;
+  }
+  if(compileTo){
+    // The C source itself for a `.c` path
+    size_t length = strlen(compileTo);
+    if(length > 2 && strcmp(compileTo + length - 2, ".c") == 0){
+      ofstream file(compileTo);
+      Codegen::write(expr, prelude, file);
+      if(!file){
+        cerr << "[Codegen] Cannot write " << compileTo << endl;
+        exit(1);
+      }
+    }else if(!Codegen::compile(expr, prelude, compileTo)){
+      cerr << "[Codegen] Cannot build " << compileTo << endl;
+      exit(1);
+    }
+    return 0;
+  }
+  Object program(expr, prelude);
+  Heap::Stats before = Heap::stats();
+  size_t reductionsBefore = reductions;
+  if(stats) Stats::start(parsed);
+  Governor::start(limits);
+  Object res = normalForm(program.expr(), program.env());
+  IO::flush();
+  if(heapStats)
+    Heap::printStats(cerr, before);
+  if(gcStats)
+    Collector::printStats(cerr);
+  if(evalStats)
+    cerr << "[Eval] reductions: " << reductions - reductionsBefore << endl;
+  if(stats)
+    Stats::print(cerr);
+
+  if(toJson){
+    Json::write(res.expr(), cout);
+    cout << endl;
+  }else if(printResult){
+    res.expr().prettyPrint();
+    cout << endl;
   }
-  Scanner scanner(rawInput);
-  Expression * expr = parseExpression(scanner);
-  Object res = normalForm(*expr, prelude);
-
-  //res.expr().prettyPrint();
-  //cout << endl;
 
+  // Sparks nobody needs may still run, leave without tearing down what
+  // they use
+  if(Parallel::threads() > 1){
+    cout.flush();
+    quick_exit(0);
+  }
   return 0;
 }
 